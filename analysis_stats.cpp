@@ -0,0 +1,163 @@
+#include "analysis_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sys/resource.h>
+#include <time.h>
+
+namespace AnalysisStats
+{
+    namespace
+    {
+        double clock_seconds(clockid_t clock)
+        {
+            timespec now;
+            clock_gettime(clock, &now);
+
+            return now.tv_sec + now.tv_nsec / 1e9;
+        }
+
+        /**
+         * The nearest rank percentile of a sorted list of values.
+         */
+        double percentile(const std::vector<double> &sorted, double p)
+        {
+            if (sorted.empty())
+                return 0;
+
+            const auto rank = (std::size_t) std::ceil(p * sorted.size());
+            return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1];
+        }
+    }
+
+    const char* stage_name(Stage stage)
+    {
+        switch (stage)
+        {
+        case OPEN:       return "open";
+        case DEMUX:      return "demux";
+        case DECODE:     return "decode";
+        case CONVERT:    return "convert";
+        case APPEND:     return "append";
+        case CHROMAGRAM: return "chromagram";
+        case FINAL:      return "final";
+        default:         return "unknown";
+        }
+    }
+
+    StageTimer::StageTimer(StageTime* stage) : stage(stage)
+    {
+        if (stage == nullptr)
+            return;
+
+        wall_start = clock_seconds(CLOCK_MONOTONIC);
+        cpu_start  = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+    }
+
+    StageTimer::~StageTimer()
+    {
+        stop();
+    }
+
+    void StageTimer::stop()
+    {
+        if (stage == nullptr)
+            return;
+
+        stage->wall += clock_seconds(CLOCK_MONOTONIC) - wall_start;
+        stage->cpu  += clock_seconds(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+        stage = nullptr;
+    }
+
+    long peak_rss_kb()
+    {
+        rusage usage;
+
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+
+        // Linux reports the maximum resident set size in kilobytes
+        return usage.ru_maxrss;
+    }
+
+    void write_file(std::ostream &output, const std::string &file_path, const FileStats &stats)
+    {
+        output << std::fixed << std::setprecision(4) << "stats: " << file_path << ':';
+
+        for (int stage = 0; stage < STAGES; ++stage)
+        {
+            output << ' ' << stage_name((Stage) stage)
+                   << ' ' << stats.stages[stage].wall << '/' << stats.stages[stage].cpu;
+        }
+
+        output << std::setprecision(1)
+               << " seconds wall/cpu, " << stats.samples << " samples, "
+               << stats.bytes_read << " bytes read, "
+               << stats.audio_seconds << "s of audio, "
+               << (stats.seconds > 0 ? stats.audio_seconds / stats.seconds : 0) << "x realtime, "
+               << stats.peak_rss_kb << " kB peak RSS" << '\n';
+    }
+
+    void Summary::add(const FileStats &stats)
+    {
+        files.push_back(stats);
+    }
+
+    void Summary::write(std::ostream &output, double seconds) const
+    {
+        double audio_seconds = 0;
+        int64_t bytes_read = 0;
+
+        for (const auto &stats : files)
+        {
+            audio_seconds += stats.audio_seconds;
+            bytes_read += stats.bytes_read;
+        }
+
+        output << std::fixed << std::setprecision(2)
+               << "stats: " << files.size() << " files in " << seconds << "s, "
+               << (seconds > 0 ? files.size() / seconds : 0) << " files/s, "
+               << (seconds > 0 ? audio_seconds / seconds : 0) << "x realtime, "
+               << bytes_read << " bytes read, "
+               << peak_rss_kb() << " kB peak RSS" << '\n';
+
+        output << std::left << std::setw(18) << "stats: stage" << std::right
+               << std::setw(10) << "p50" << std::setw(10) << "p95" << std::setw(10) << "p99"
+               << std::setw(12) << "total wall" << std::setw(12) << "total cpu" << '\n';
+
+        output << std::setprecision(4);
+
+        // Each stage, followed by the time taken by each file as a whole
+        for (int stage = 0; stage <= STAGES; ++stage)
+        {
+            std::vector<double> wall;
+            double total_wall = 0, total_cpu = 0;
+
+            for (const auto &stats : files)
+            {
+                const double file_wall = stage < STAGES ? stats.stages[stage].wall : stats.seconds;
+
+                wall.push_back(file_wall);
+                total_wall += file_wall;
+
+                for (int i = 0; i < STAGES; ++i)
+                {
+                    if (stage == STAGES || i == stage)
+                        total_cpu += stats.stages[i].cpu;
+                }
+            }
+
+            std::sort(wall.begin(), wall.end());
+
+            const std::string name = stage < STAGES ? stage_name((Stage) stage) : "file";
+
+            output << std::left << std::setw(18) << "stats: " + name << std::right
+                   << std::setw(10) << percentile(wall, 0.50)
+                   << std::setw(10) << percentile(wall, 0.95)
+                   << std::setw(10) << percentile(wall, 0.99)
+                   << std::setw(12) << total_wall
+                   << std::setw(12) << total_cpu << '\n';
+        }
+    }
+}
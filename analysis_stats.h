@@ -0,0 +1,131 @@
+#ifndef ANALYSIS_STATS_H
+#define ANALYSIS_STATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Instrumentation of where the time goes while analyzing files, enabled
+ * with --stats. Each stage of the analysis of a file is timed separately, in
+ * both wall and CPU time, and a summary of the whole batch is built from the
+ * stages of every file.
+ *
+ * Decoding and building the chromagram run on separate threads, so the wall
+ * times of the stages of a single file overlap and don't add up to the time
+ * taken to analyze it.
+ */
+namespace AnalysisStats
+{
+    enum Stage
+    {
+        // Opening the file and probing its streams
+        OPEN,
+        // Reading packets from the container
+        DEMUX,
+        // Decoding packets into frames
+        DECODE,
+        // Converting or resampling frames into float samples
+        CONVERT,
+        // Copying samples into KeyFinder::AudioData chunks
+        APPEND,
+        // Feeding chunks into the progressive chromagram
+        CHROMAGRAM,
+        // Finalizing and collapsing the chromagram
+        FINAL,
+        STAGES,
+    };
+
+    /**
+     * The display name of a stage.
+     */
+    const char* stage_name(Stage stage);
+
+    struct StageTime
+    {
+        double wall = 0;
+        double cpu  = 0;
+    };
+
+    /**
+     * Measurements of the analysis of a single file.
+     */
+    struct FileStats
+    {
+        StageTime stages[STAGES];
+
+        // The number of samples (not frames) decoded, and the length of the
+        // audio they make up in seconds
+        uint64_t samples = 0;
+        double audio_seconds = 0;
+
+        // The number of bytes read from the file
+        int64_t bytes_read = 0;
+
+        // The wall time taken to analyze the file, start to finish
+        double seconds = 0;
+
+        // The peak resident set size of the process once the file was done
+        long peak_rss_kb = 0;
+    };
+
+    /**
+     * Adds the wall and CPU time of the calling thread between its
+     * construction and destruction to a stage. A timer without a stage to add
+     * to does nothing, so instrumented code costs nothing without --stats.
+     */
+    class StageTimer
+    {
+    public:
+        explicit StageTimer(StageTime* stage);
+        ~StageTimer();
+
+        /**
+         * Add the time so far to the stage and stop timing.
+         */
+        void stop();
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+        StageTime* stage;
+        double wall_start;
+        double cpu_start;
+    };
+
+    /**
+     * The peak resident set size of this process in kilobytes.
+     */
+    long peak_rss_kb();
+
+    /**
+     * Write the measurements of a single file as one line.
+     */
+    void write_file(std::ostream &output, const std::string &file_path, const FileStats &stats);
+
+    /**
+     * Collects the measurements of every analyzed file in a batch.
+     */
+    class Summary
+    {
+    public:
+        void add(const FileStats &stats);
+
+        /**
+         * Write the p50, p95 and p99 wall time of each stage across all of
+         * the files, along with the totals, throughput in files per second
+         * and the realtime factor of the batch.
+         *
+         * @param output  The stream to write the summary to
+         * @param seconds The wall time taken by the whole batch
+         */
+        void write(std::ostream &output, double seconds) const;
+
+    private:
+        std::vector<FileStats> files;
+    };
+}
+
+#endif
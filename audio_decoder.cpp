@@ -0,0 +1,1151 @@
+#include "audio_decoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <keyfinder/constants.h>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+#include <libavutil/opt.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+}
+
+// FFmpeg 5.1 moved channel counts and masks into AVChannelLayout, and later
+// versions drop the old channels and channel_layout fields entirely
+#define HAVE_CH_LAYOUT (LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100))
+
+const int BAD_PACKET_THRESHOLD = 100;
+
+// Scales float samples into the range of 16 bit PCM samples
+const float S16_SCALE = 32768.0f;
+
+// The size of the buffer encoded audio is read into from an AudioSource
+const int SOURCE_BUFFER_SIZE = 1 << 16;
+
+// The bytes read and the microseconds of the stream analyzed to determine the
+// stream information when probing quickly
+const int64_t FAST_PROBE_SIZE = 1 << 16;
+const int64_t FAST_ANALYZE_DURATION = AV_TIME_BASE / 2;
+
+/**
+ * A file opened for reading, which is closed when the wrapper goes away.
+ */
+struct SafeFileDescriptor
+{
+    int fd;
+
+    explicit SafeFileDescriptor(const char* file_path)
+        : fd(open(file_path, O_RDONLY | O_CLOEXEC))
+    {
+    }
+
+    ~SafeFileDescriptor()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    SafeFileDescriptor(const SafeFileDescriptor&) = delete;
+    SafeFileDescriptor& operator=(const SafeFileDescriptor&) = delete;
+};
+
+/**
+ * The "safe" AVPacket wrapper will handle memory management of the packet,
+ * ensuring that if an instance of this packet wrapper is destroyed the
+ * containing packet is freed from memory.
+ */
+struct SafeAVPacket
+{
+    AVPacket inner_packet;
+
+    SafeAVPacket()
+    {
+        av_init_packet(&inner_packet);
+
+        inner_packet.data = nullptr;
+        inner_packet.size = 0;
+    }
+
+    ~SafeAVPacket()
+    {
+        if (inner_packet.data)
+        {
+            av_packet_unref(&inner_packet);
+        }
+    }
+
+    /**
+     * Read into this packet from the format_context. A stream index should
+     * also be provided so that the packet knows what stream to read from.
+     *
+     * @param format_context The format context to read data from
+     * @param stream_index   The index of the stream we want data from
+     * @return false at the end of the stream, or when it can't be read any
+     *         further, leaving the packet empty
+     */
+    bool read(AVFormatContext* format_context, int stream_index)
+    {
+        while (true)
+        {
+            if (inner_packet.data)
+            {
+                av_packet_unref(&inner_packet);
+            }
+
+            if (av_read_frame(format_context, &inner_packet) < 0)
+            {
+                inner_packet.data = nullptr;
+                inner_packet.size = 0;
+                return false;
+            }
+
+            // Stop reading once we've read a packet from this stream
+            if (inner_packet.stream_index == stream_index)
+                return true;
+        }
+    }
+};
+
+/**
+ * The time by which a file must have been decoded, for DecodeOptions
+ * max_seconds. The deadline is also the interrupt callback of the format
+ * context, so that FFmpeg gives up on opening, probing and reading a file
+ * once it has passed too.
+ */
+struct DecodeDeadline
+{
+    bool enabled;
+    std::chrono::steady_clock::time_point deadline;
+
+    explicit DecodeDeadline(double max_seconds)
+        : enabled(max_seconds > 0),
+          deadline(std::chrono::steady_clock::now()
+                  + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>(enabled ? max_seconds : 0)))
+    {
+    }
+
+    bool passed() const
+    {
+        return enabled && std::chrono::steady_clock::now() >= deadline;
+    }
+
+    /**
+     * Throw the error of a file which took too long, once it has.
+     */
+    void check() const
+    {
+        if (passed())
+            throw std::runtime_error("Decoding took longer than the time limit");
+    }
+
+    static int interrupt(void* opaque)
+    {
+        return ((const DecodeDeadline*) opaque)->passed() ? 1 : 0;
+    }
+};
+
+unsigned int decimated_sample_rate(unsigned int sample_rate)
+{
+    // This mirrors the downsample factor computed in KeyFinder::preprocess
+    const double cutoff = KeyFinder::getLastFrequency() * 1.10;
+    const auto factor = (unsigned int) std::floor(sample_rate / 2 / cutoff);
+
+    for (unsigned int divisor = factor / 2; divisor > 1; --divisor)
+    {
+        if (factor % divisor == 0 && sample_rate % divisor == 0)
+            return sample_rate / divisor;
+    }
+
+    return sample_rate;
+}
+
+std::vector<AnalysisWindow> analysis_windows(const DecodeOptions &options, double stream_duration)
+{
+    const double end = options.duration > 0 && options.segments == 0
+        ? options.start + options.duration
+        : HUGE_VAL;
+
+    if (options.segments == 0 || stream_duration <= 0)
+    {
+        if (options.start <= 0 && end == HUGE_VAL)
+            return {};
+
+        return {{options.start, end}};
+    }
+
+    // Segments are spread evenly between the start and the end of the stream,
+    // once they cover the whole span they're decoded as one continuous window
+    const double span = stream_duration - options.start;
+    const double length = options.duration > 0 ? options.duration : DEFAULT_SEGMENT_DURATION;
+
+    if (length * options.segments >= span)
+        return {{options.start, HUGE_VAL}};
+
+    std::vector<AnalysisWindow> windows;
+    const double spacing = options.segments > 1 ? (span - length) / (options.segments - 1) : 0;
+    const double first = options.segments > 1 ? options.start : options.start + (span - length) / 2;
+
+    for (unsigned int i = 0; i < options.segments; ++i)
+    {
+        const double begin = first + i * spacing;
+        windows.push_back({begin, begin + length});
+    }
+
+    return windows;
+}
+
+bool is_direct_sample_format(int format)
+{
+    return format == AV_SAMPLE_FMT_S16 || format == AV_SAMPLE_FMT_S16P
+        || format == AV_SAMPLE_FMT_FLT || format == AV_SAMPLE_FMT_FLTP;
+}
+
+void convert_samples(const AVFrame* frame, unsigned int channels, float* output)
+{
+    const std::size_t frames = frame->nb_samples;
+    const std::size_t count = frames * channels;
+
+    // With a single channel planar and interleaved data are laid out the same
+    int format = frame->format;
+
+    if (channels == 1)
+    {
+        if (format == AV_SAMPLE_FMT_S16P) format = AV_SAMPLE_FMT_S16;
+        if (format == AV_SAMPLE_FMT_FLTP) format = AV_SAMPLE_FMT_FLT;
+    }
+
+    switch (format)
+    {
+    case AV_SAMPLE_FMT_S16:
+    {
+        const int16_t* input = (const int16_t*) frame->extended_data[0];
+
+        for (std::size_t i = 0; i < count; ++i)
+            output[i] = input[i];
+
+        break;
+    }
+    case AV_SAMPLE_FMT_FLT:
+    {
+        const float* input = (const float*) frame->extended_data[0];
+
+        for (std::size_t i = 0; i < count; ++i)
+            output[i] = input[i] * S16_SCALE;
+
+        break;
+    }
+    case AV_SAMPLE_FMT_S16P:
+        for (unsigned int c = 0; c < channels; ++c)
+        {
+            const int16_t* input = (const int16_t*) frame->extended_data[c];
+
+            for (std::size_t i = 0; i < frames; ++i)
+                output[i * channels + c] = input[i];
+        }
+
+        break;
+    case AV_SAMPLE_FMT_FLTP:
+        for (unsigned int c = 0; c < channels; ++c)
+        {
+            const float* input = (const float*) frame->extended_data[c];
+
+            for (std::size_t i = 0; i < frames; ++i)
+                output[i * channels + c] = input[i] * S16_SCALE;
+        }
+
+        break;
+    default:
+        throw std::runtime_error("Unexpected sample format");
+    }
+}
+
+bool is_silent(const float* samples, std::size_t count, double threshold)
+{
+    // Compare the mean square of the samples with the square of the level,
+    // rather than taking the square root and logarithm of every block
+    const double level = S16_SCALE * std::pow(10.0, threshold / 20);
+    double sum = 0;
+
+    for (std::size_t i = 0; i < count; ++i)
+        sum += (double) samples[i] * samples[i];
+
+    return sum < level * level * count;
+}
+
+void append_samples(KeyFinder::AudioData &audio, const float* samples, std::size_t count)
+{
+    const unsigned int offset = audio.getSampleCount();
+
+    audio.addToSampleCount(count);
+    audio.resetIterators();
+    audio.advanceWriteIterator(offset);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        audio.setSampleAtWriteIterator(samples[i]);
+        audio.advanceWriteIterator();
+    }
+}
+
+std::shared_ptr<SwrContext> float_resampler(int format, int sample_rate, unsigned int channels,
+        uint64_t layout, unsigned int out_channels, int out_rate)
+{
+    SwrContext* resample_ctx_ptr = nullptr;
+
+    // The channel layout may need to be populated from the number of
+    // channels. This is usually the case with formats using the pcm_16*
+    // codecs where it's not nessicarily possible to determine the channel
+    // layout. In these situations we can use the default channel layout.
+#if HAVE_CH_LAYOUT
+    AVChannelLayout in_layout = {}, out_layout = {};
+
+    if (layout == 0 || av_channel_layout_from_mask(&in_layout, layout) < 0
+            || in_layout.nb_channels != (int) channels)
+        av_channel_layout_default(&in_layout, channels);
+
+    if (out_channels != channels)
+        av_channel_layout_default(&out_layout, out_channels);
+    else
+        av_channel_layout_copy(&out_layout, &in_layout);
+
+    swr_alloc_set_opts2(&resample_ctx_ptr, &out_layout, AV_SAMPLE_FMT_FLT, out_rate,
+            &in_layout, (AVSampleFormat) format, sample_rate, 0, nullptr);
+
+    av_channel_layout_uninit(&in_layout);
+    av_channel_layout_uninit(&out_layout);
+#else
+    if (layout == 0 || av_get_channel_layout_nb_channels(layout) != (int) channels)
+        layout = av_get_default_channel_layout(channels);
+
+    const uint64_t out_layout = out_channels != channels
+        ? av_get_default_channel_layout(out_channels)
+        : layout;
+
+    resample_ctx_ptr = swr_alloc_set_opts(nullptr, out_layout, AV_SAMPLE_FMT_FLT, out_rate,
+            layout, (AVSampleFormat) format, sample_rate, 0, nullptr);
+#endif
+
+    std::shared_ptr<SwrContext> resample_context(resample_ctx_ptr, [](SwrContext* c) { swr_free(&c); });
+
+    if (resample_ctx_ptr == nullptr || swr_init(resample_ctx_ptr) < 0)
+        throw std::runtime_error("Unable to open the resample context");
+
+    return resample_context;
+}
+
+void resample_samples(SwrContext* resampler, const AVFrame* frame, unsigned int channels,
+        std::vector<float> &output)
+{
+    const int in_samples = frame ? frame->nb_samples : 0;
+
+    const int out_samples = swr_get_out_samples(resampler, in_samples);
+
+    if (out_samples < 0)
+        throw std::runtime_error("Unable to resample audio into float PCM data");
+
+    const std::size_t offset = output.size();
+    output.resize(offset + (std::size_t) out_samples * channels);
+
+    auto data = (uint8_t*) (output.data() + offset);
+
+    const int converted = swr_convert(resampler, &data, out_samples,
+            frame ? (const uint8_t**) frame->extended_data : nullptr, in_samples);
+
+    if (converted < 0)
+        throw std::runtime_error("Unable to resample audio into float PCM data");
+
+    output.resize(offset + (std::size_t) converted * channels);
+
+    for (std::size_t i = offset; i < output.size(); ++i)
+        output[i] *= S16_SCALE;
+}
+
+namespace
+{
+/**
+ * The format of decoded audio, which converting it into float samples is set
+ * up for. Decoders may change it from one frame to the next, such as when a
+ * stream is a concatenation of streams of different channel counts.
+ */
+struct SampleFormat
+{
+    int format;
+    int sample_rate;
+    unsigned int channels;
+    uint64_t layout;
+
+    bool operator!=(const SampleFormat &other) const
+    {
+        return format != other.format || sample_rate != other.sample_rate
+            || channels != other.channels || layout != other.layout;
+    }
+};
+
+SampleFormat codec_sample_format(const AVCodecContext* codec_context)
+{
+#if HAVE_CH_LAYOUT
+    const AVChannelLayout &layout = codec_context->ch_layout;
+
+    return {codec_context->sample_fmt, codec_context->sample_rate, (unsigned int) layout.nb_channels,
+        layout.order == AV_CHANNEL_ORDER_NATIVE ? layout.u.mask : 0};
+#else
+    return {codec_context->sample_fmt, codec_context->sample_rate,
+        (unsigned int) codec_context->channels, codec_context->channel_layout};
+#endif
+}
+
+SampleFormat frame_sample_format(const AVFrame* frame)
+{
+#if HAVE_CH_LAYOUT
+    const AVChannelLayout &layout = frame->ch_layout;
+
+    return {frame->format, frame->sample_rate, (unsigned int) layout.nb_channels,
+        layout.order == AV_CHANNEL_ORDER_NATIVE ? layout.u.mask : 0};
+#else
+    return {frame->format, frame->sample_rate, (unsigned int) frame->channels, frame->channel_layout};
+#endif
+}
+
+/**
+ * The duration of an audio stream in seconds, as given by its container, or 0
+ * when it isn't known.
+ */
+double stream_duration(const AVFormatContext* format_ctx_ptr, const AVStream* audio_stream)
+{
+    if (format_ctx_ptr->duration != AV_NOPTS_VALUE)
+        return format_ctx_ptr->duration / (double) AV_TIME_BASE;
+
+    if (audio_stream->duration != AV_NOPTS_VALUE)
+        return audio_stream->duration * av_q2d(audio_stream->time_base);
+
+    return 0;
+}
+
+/**
+ * Decode the audio stream of an opened input into AudioData chunks, as
+ * described for fill_audio_data.
+ *
+ * @param format_ctx_ptr The opened input
+ * @param sample_buffer  The buffer to collect decoded samples in, or null
+ * @param deadline       The deadline the input was opened with
+ * @param open_timer     Times opening the input, stopped once the decoder
+ *                       has been set up
+ */
+void decode_audio(AVFormatContext* format_ctx_ptr, const DecodeOptions &options,
+        const audio_chunk_handler &handle_chunk, AnalysisStats::FileStats* stats,
+        std::vector<float>* sample_buffer, const DecodeDeadline &deadline,
+        AnalysisStats::StageTimer &open_timer)
+{
+    auto stage = [stats](AnalysisStats::Stage stage)
+    {
+        return stats ? &stats->stages[stage] : nullptr;
+    };
+
+    // Determine stream information
+    if (avformat_find_stream_info(format_ctx_ptr, nullptr) < 0)
+    {
+        deadline.check();
+        throw std::runtime_error("Unable to get stream info");
+    }
+
+    // Let FFmpeg pick the most suitable audio stream, which is the one it
+    // would play
+    const int stream_index = av_find_best_stream(format_ctx_ptr, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+
+    if (stream_index < 0)
+        throw std::runtime_error("File does not have any audio streams");
+
+    const AVStream* audio_stream = format_ctx_ptr->streams[stream_index];
+
+    // Have the demuxer skip the packets of every other stream, such as video
+    // and cover art, rather than reading them only for them to be dropped
+    for (unsigned int i = 0; i < format_ctx_ptr->nb_streams; ++i)
+    {
+        if ((int) i != stream_index)
+            format_ctx_ptr->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    // Find the codec handler and set up a codec context of our own for it
+    const auto codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
+
+    if (codec == nullptr)
+        throw std::runtime_error("Unsupported audio stream");
+
+    std::shared_ptr<AVCodecContext> codec_context_owner(avcodec_alloc_context3(codec),
+            [](AVCodecContext* c) { avcodec_free_context(&c); });
+    const auto codec_context = codec_context_owner.get();
+
+    if (codec_context == nullptr
+            || avcodec_parameters_to_context(codec_context, audio_stream->codecpar) < 0)
+        throw std::runtime_error("Unable to set up the codec");
+
+    codec_context->pkt_timebase = audio_stream->time_base;
+
+    // Decoders supporting it decode on several threads, 0 letting FFmpeg pick
+    // the number of threads
+    codec_context->thread_count = options.decode_threads;
+    codec_context->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    // Open the codec
+    if (avcodec_open2(codec_context, codec, nullptr) < 0)
+        throw std::runtime_error("Unable to open the codec");
+
+    SampleFormat in_format = codec_sample_format(codec_context);
+
+    if (in_format.channels == 0 || in_format.sample_rate <= 0)
+        throw std::runtime_error("Unsupported audio stream");
+
+    // When downmixing the resampler also takes care of reducing the audio
+    // to a single channel at a lower sample rate. Every chunk is handed off
+    // in the channels and sample rate the stream starts with, as the
+    // chromagram can't take audio of another rate part way through.
+    const unsigned int channels = options.downmix ? 1 : in_format.channels;
+    int out_sample_rate = in_format.sample_rate;
+
+    if (options.downmix)
+        out_sample_rate = decimated_sample_rate(in_format.sample_rate);
+
+    // Most decoders output 16 bit PCM or float samples which can be converted
+    // straight to the floats AudioData stores. Anything else, or any change in
+    // channels or sample rate, goes through the resampler.
+    bool needs_resample = false;
+    std::shared_ptr<SwrContext> resample_context;
+
+    auto set_up_conversion = [&]()
+    {
+        needs_resample = options.downmix || ! is_direct_sample_format(in_format.format)
+            || in_format.channels != channels || in_format.sample_rate != out_sample_rate;
+
+        resample_context.reset();
+
+        if (needs_resample)
+        {
+            resample_context = float_resampler(in_format.format, in_format.sample_rate,
+                    in_format.channels, in_format.layout, channels, out_sample_rate);
+        }
+    };
+
+    set_up_conversion();
+
+    // Files which say up front that they are too long aren't decoded at all
+    const double duration = stream_duration(format_ctx_ptr, audio_stream);
+
+    if (options.max_duration > 0 && duration > options.max_duration)
+        throw std::runtime_error("Audio is longer than the duration limit");
+
+    open_timer.stop();
+
+    // Decoded samples are collected into a contiguous buffer and moved into
+    // an AudioData chunk in a single pass once a whole chunk is available.
+    // When the duration of the stream is known there is no need to reserve
+    // more room than the stream will ever use. A buffer the caller passes in
+    // keeps its capacity from one stream to the next.
+    std::size_t chunk_frames = STREAM_CHUNK_FRAMES;
+
+    if (audio_stream->duration != AV_NOPTS_VALUE)
+    {
+        const auto stream_frames = av_rescale_q(audio_stream->duration,
+                audio_stream->time_base, av_make_q(1, out_sample_rate));
+
+        if (stream_frames > 0)
+            chunk_frames = std::min<std::size_t>(chunk_frames, stream_frames);
+    }
+
+    std::vector<float> local_samples;
+    std::vector<float> &samples = sample_buffer ? *sample_buffer : local_samples;
+    samples.clear();
+    samples.reserve(chunk_frames * channels);
+
+    const std::size_t chunk_samples = (std::size_t) STREAM_CHUNK_FRAMES * channels;
+
+    auto flush_samples = [&]()
+    {
+        KeyFinder::AudioData audio;
+        audio.setFrameRate((unsigned int) out_sample_rate);
+        audio.setChannels(channels);
+
+        {
+            AnalysisStats::StageTimer timer(stage(AnalysisStats::APPEND));
+
+            append_samples(audio, samples.data(), samples.size());
+            samples.clear();
+        }
+
+        return handle_chunk(audio);
+    };
+
+    // Drop the samples added to the sample buffer from an offset when they
+    // are quieter than the silence threshold, so that silence never reaches
+    // the chromagram
+    auto gate_silence = [&](std::size_t offset)
+    {
+        if (options.silence_threshold < 0
+                && is_silent(samples.data() + offset, samples.size() - offset, options.silence_threshold))
+            samples.resize(offset);
+    };
+
+    // Convert the samples of a frame into the sample buffer, handing off a
+    // chunk whenever one has been filled
+    auto append_frame = [&](const AVFrame* frame)
+    {
+        {
+            AnalysisStats::StageTimer timer(stage(AnalysisStats::CONVERT));
+
+            const std::size_t offset = samples.size();
+            samples.resize(offset + (std::size_t) frame->nb_samples * channels);
+
+            convert_samples(frame, channels, samples.data() + offset);
+            gate_silence(offset);
+        }
+
+        return samples.size() < chunk_samples || flush_samples();
+    };
+
+    // Resample a decoded frame into float PCM data. Passing no frame flushes
+    // any samples buffered in the resampler.
+    auto resample_frame = [&](AVFrame* frame)
+    {
+        {
+            AnalysisStats::StageTimer timer(stage(AnalysisStats::CONVERT));
+
+            const std::size_t offset = samples.size();
+
+            resample_samples(resample_context.get(), frame, channels, samples);
+            gate_silence(offset);
+        }
+
+        return samples.size() < chunk_samples || flush_samples();
+    };
+
+    SafeAVPacket packet;
+    std::shared_ptr<AVFrame> audio_frame(av_frame_alloc(), [](AVFrame* f) { av_frame_free(&f); });
+
+    int back_packet_count = 0;
+
+    // All of the audio decoded, whether or not it is analyzed, counts
+    // against the limits
+    uint64_t decoded_samples = 0;
+    double decoded_seconds = 0;
+
+    // Once the stream has ended the decoder is drained of the frames it is
+    // still holding on to
+    bool draining = false;
+
+    // Work out which windows of the stream are to be decoded
+    const auto windows = analysis_windows(options, duration);
+    std::size_t current_window = 0;
+
+    const int64_t stream_start = audio_stream->start_time != AV_NOPTS_VALUE
+        ? audio_stream->start_time
+        : 0;
+
+    // The time just past the last decoded frame, for frames without a timestamp
+    double next_frame_time = 0;
+
+    // Seek to the start of the current window. When the stream can't be
+    // seeked it is decoded up to the window instead, with the frames before
+    // it being dropped. Returns whether the stream was seeked.
+    auto seek_to_window = [&]()
+    {
+        const double begin = windows[current_window].begin;
+
+        if (begin <= next_frame_time)
+            return false;
+
+        const auto timestamp = stream_start + (int64_t) (begin / av_q2d(audio_stream->time_base));
+
+        if (av_seek_frame(format_ctx_ptr, audio_stream->index, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+            return false;
+
+        avcodec_flush_buffers(codec_context);
+        draining = false;
+        return true;
+    };
+
+    if ( ! windows.empty())
+        seek_to_window();
+
+    // Read all stream samples into AudioData chunks
+    while (true)
+    {
+        // Hand the decoder another packet, or let it know the stream has
+        // ended so it can be drained
+        if ( ! draining)
+        {
+            {
+                AnalysisStats::StageTimer timer(stage(AnalysisStats::DEMUX));
+                draining = ! packet.read(format_ctx_ptr, audio_stream->index) || packet.inner_packet.size <= 0;
+            }
+
+            if (stats && format_ctx_ptr->pb)
+                stats->bytes_read = format_ctx_ptr->pb->bytes_read;
+
+            // A read interrupted by the deadline looks just like the end of
+            // the stream
+            deadline.check();
+
+            AnalysisStats::StageTimer decode_timer(stage(AnalysisStats::DECODE));
+
+            const int sent = avcodec_send_packet(codec_context, draining ? nullptr : &packet.inner_packet);
+
+            decode_timer.stop();
+
+            // Bad packet. Maybe we can ignore it
+            if (sent < 0 && sent != AVERROR_EOF)
+            {
+                if (++back_packet_count > BAD_PACKET_THRESHOLD)
+                    throw std::runtime_error("Too many bad packets");
+
+                continue;
+            }
+        }
+
+        // Take every frame the packet decoded into. The decoder wants another
+        // packet once it returns EAGAIN, and has been drained at AVERROR_EOF.
+        int received;
+
+        while (true)
+        {
+            AnalysisStats::StageTimer decode_timer(stage(AnalysisStats::DECODE));
+
+            received = avcodec_receive_frame(codec_context, audio_frame.get());
+
+            decode_timer.stop();
+
+            if (received < 0)
+                break;
+
+            const SampleFormat frame_format = frame_sample_format(audio_frame.get());
+
+            if (frame_format.channels == 0 || frame_format.sample_rate <= 0)
+                throw std::runtime_error("Unexpected audio format");
+
+            const double frame_seconds = audio_frame->nb_samples / (double) frame_format.sample_rate;
+
+            decoded_samples += (uint64_t) audio_frame->nb_samples * frame_format.channels;
+            decoded_seconds += frame_seconds;
+
+            if (options.max_samples > 0 && decoded_samples > options.max_samples)
+                throw std::runtime_error("Decoded more samples than the sample limit");
+
+            if (options.max_duration > 0 && decoded_seconds > options.max_duration)
+                throw std::runtime_error("Audio is longer than the duration limit");
+
+            deadline.check();
+
+            if (stats)
+            {
+                stats->samples += (uint64_t) audio_frame->nb_samples * frame_format.channels;
+                stats->audio_seconds += frame_seconds;
+            }
+
+            // Whole frames are kept for any frame that overlaps the window
+            // being decoded. Once the window has been passed move on to the
+            // next one. Seeking flushes the decoder, which then wants a packet
+            // from the new position.
+            if ( ! windows.empty())
+            {
+                const auto timestamp = audio_frame->best_effort_timestamp;
+
+                const double frame_time = timestamp != AV_NOPTS_VALUE
+                    ? (timestamp - stream_start) * av_q2d(audio_stream->time_base)
+                    : next_frame_time;
+
+                next_frame_time = frame_time + frame_seconds;
+
+                if (next_frame_time <= windows[current_window].begin)
+                    continue;
+
+                if (frame_time >= windows[current_window].end)
+                {
+                    bool seeked = false;
+
+                    while ( ! seeked && current_window < windows.size()
+                            && frame_time >= windows[current_window].end)
+                    {
+                        if (++current_window < windows.size())
+                            seeked = seek_to_window();
+                    }
+
+                    if (current_window == windows.size())
+                    {
+                        received = AVERROR_EOF;
+                        break;
+                    }
+
+                    // The frame is from before a seek, but without one it
+                    // may well overlap the next window already
+                    if (seeked || next_frame_time <= windows[current_window].begin)
+                        continue;
+                }
+            }
+
+            // When the format changes the resampler is drained of the audio
+            // it holds in the old format, before converting the frame
+            if (frame_format != in_format)
+            {
+                if (needs_resample && ! resample_frame(nullptr))
+                    return;
+
+                in_format = frame_format;
+                set_up_conversion();
+            }
+
+            // If we didn't decode audio data in a format we can convert
+            // directly we have to re-sample
+            if (needs_resample)
+            {
+                if ( ! resample_frame(audio_frame.get()))
+                    return;
+
+                continue;
+            }
+
+            if ( ! append_frame(audio_frame.get()))
+                return;
+        }
+
+        // We're all done once the decoder has been drained
+        if (received == AVERROR_EOF)
+            break;
+
+        // A frame which failed to decode. Maybe we can ignore it
+        if (received != AVERROR(EAGAIN) && ++back_packet_count > BAD_PACKET_THRESHOLD)
+            throw std::runtime_error("Too many bad packets");
+    }
+
+    // The resampler may be holding on to a few samples when the sample rate
+    // is being changed
+    if (needs_resample && ! resample_frame(nullptr))
+        return;
+
+    // Hand off whatever is left over in the last chunk
+    if ( ! samples.empty())
+        flush_samples();
+}
+
+/**
+ * Allocate the format context an input is opened with.
+ *
+ * @param deadline The deadline for decoding the input, which must outlive
+ *                 the context
+ */
+AVFormatContext* alloc_format_context(const DecodeOptions &options, const DecodeDeadline &deadline)
+{
+    AVFormatContext* format_ctx_ptr = avformat_alloc_context();
+
+    if (format_ctx_ptr == nullptr)
+        throw std::runtime_error("Unable to allocate the format context");
+
+    if (deadline.enabled)
+    {
+        format_ctx_ptr->interrupt_callback.callback = &DecodeDeadline::interrupt;
+        format_ctx_ptr->interrupt_callback.opaque = (void*) &deadline;
+    }
+
+    if (options.fast_probe)
+    {
+        format_ctx_ptr->probesize = FAST_PROBE_SIZE;
+        format_ctx_ptr->max_analyze_duration = FAST_ANALYZE_DURATION;
+    }
+
+    return format_ctx_ptr;
+}
+
+/**
+ * Register the FFmpeg formats and codecs, once, where that is still needed.
+ */
+void initialize_ffmpeg()
+{
+    // Newer FFmpeg versions register everything up front themselves
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() { av_register_all(); });
+#endif
+}
+
+/**
+ * Pass reads and seeks of an AVIOContext on to its AudioSource.
+ */
+int read_source(void* opaque, uint8_t* buffer, int size)
+{
+    const int count = ((AudioSource*) opaque)->read(buffer, size);
+
+    return count == 0 ? AVERROR_EOF : count;
+}
+
+int64_t seek_source(void* opaque, int64_t offset, int whence)
+{
+    return ((AudioSource*) opaque)->seek(offset, whence);
+}
+}
+
+AudioSource memory_source(const uint8_t* data, std::size_t size)
+{
+    auto position = std::make_shared<std::size_t>(0);
+
+    AudioSource source;
+
+    source.read = [=](uint8_t* buffer, int buffer_size)
+    {
+        const auto count = std::min<std::size_t>(buffer_size, size - *position);
+
+        std::memcpy(buffer, data + *position, count);
+        *position += count;
+
+        return (int) count;
+    };
+
+    source.seek = [=](int64_t offset, int whence) -> int64_t
+    {
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case AVSEEK_SIZE: return size;
+        case SEEK_SET:    break;
+        case SEEK_CUR:    offset += *position; break;
+        case SEEK_END:    offset += size; break;
+        default:          return -1;
+        }
+
+        if (offset < 0 || (uint64_t) offset > size)
+            return -1;
+
+        *position = offset;
+        return offset;
+    };
+
+    return source;
+}
+
+AudioSource file_descriptor_source(int fd)
+{
+    AudioSource source;
+
+    source.read = [fd](uint8_t* buffer, int size)
+    {
+        ssize_t count;
+
+        do
+            count = ::read(fd, buffer, size);
+        while (count < 0 && errno == EINTR);
+
+        return count < 0 ? AVERROR(errno) : (int) count;
+    };
+
+    if (lseek(fd, 0, SEEK_CUR) < 0)
+        return source;
+
+    source.seek = [fd](int64_t offset, int whence) -> int64_t
+    {
+        if (whence & AVSEEK_SIZE)
+        {
+            struct stat file_stat;
+            return fstat(fd, &file_stat) < 0 ? -1 : file_stat.st_size;
+        }
+
+        return lseek(fd, offset, whence & ~AVSEEK_FORCE);
+    };
+
+    return source;
+}
+
+void prefetch_file(const char* file_path)
+{
+    SafeFileDescriptor file(file_path);
+
+    if (file.fd >= 0)
+        posix_fadvise(file.fd, 0, 0, POSIX_FADV_WILLNEED);
+}
+
+double probe_duration(const char* file_path)
+{
+    if (std::strcmp(file_path, "-") == 0)
+        return 0;
+
+    initialize_ffmpeg();
+
+    DecodeOptions options;
+    options.fast_probe = true;
+
+    const DecodeDeadline deadline(options.max_seconds);
+    AVFormatContext* format_ctx_ptr = nullptr;
+
+    try
+    {
+        format_ctx_ptr = alloc_format_context(options, deadline);
+    }
+    catch (std::exception &e)
+    {
+        return 0;
+    }
+
+    if (avformat_open_input(&format_ctx_ptr, file_path, nullptr, nullptr) < 0)
+        return 0;
+
+    // Closed along with its file, every file of a batch may be probed
+    std::shared_ptr<AVFormatContext> format_context(format_ctx_ptr,
+            [](AVFormatContext* c) { avformat_close_input(&c); });
+
+    if (avformat_find_stream_info(format_ctx_ptr, nullptr) < 0)
+        return 0;
+
+    const int stream_index = av_find_best_stream(format_ctx_ptr, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+
+    if (stream_index < 0)
+        return 0;
+
+    return stream_duration(format_ctx_ptr, format_ctx_ptr->streams[stream_index]);
+}
+
+namespace
+{
+/**
+ * Decode a file by mapping all of it into memory and reading it as a memory
+ * source. The kernel is told the mapping is read sequentially, so it reads
+ * ahead aggressively.
+ */
+void fill_mapped_audio_data(const char* file_path, const DecodeOptions &options,
+        const audio_chunk_handler &handle_chunk, AnalysisStats::FileStats* stats,
+        std::vector<float>* sample_buffer)
+{
+    SafeFileDescriptor file(file_path);
+    struct stat file_stat;
+
+    if (file.fd < 0 || fstat(file.fd, &file_stat) < 0 || ! S_ISREG(file_stat.st_mode))
+        throw std::runtime_error("Unable to open audio file (File doesn't exist or isn't a regular file)");
+
+    const std::size_t size = file_stat.st_size;
+
+    // Empty files can't be mapped, and hold no audio to decode in any case
+    if (size == 0)
+        throw std::runtime_error("Unable to open audio (Unhandled format)");
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Unable to map audio file into memory");
+
+    std::shared_ptr<void> mapping(data, [size](void* data) { munmap(data, size); });
+
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    fill_audio_data(memory_source((const uint8_t*) data, size), options, handle_chunk, stats, sample_buffer);
+}
+}
+
+void fill_audio_data(const char* file_path, const DecodeOptions &options,
+        const audio_chunk_handler &handle_chunk, AnalysisStats::FileStats* stats,
+        std::vector<float>* sample_buffer)
+{
+    if (std::strcmp(file_path, "-") == 0)
+        return fill_audio_data(file_descriptor_source(STDIN_FILENO), options, handle_chunk, stats, sample_buffer);
+
+    if (options.map_files)
+        return fill_mapped_audio_data(file_path, options, handle_chunk, stats, sample_buffer);
+
+    // Read the file in large blocks ourselves, letting the kernel read ahead
+    // further than it otherwise would
+    if (options.io_buffer_size > 0)
+    {
+        SafeFileDescriptor file(file_path);
+
+        if (file.fd < 0)
+            throw std::runtime_error("Unable to open audio file (File doesn't exist)");
+
+        posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        return fill_audio_data(file_descriptor_source(file.fd), options, handle_chunk, stats, sample_buffer);
+    }
+
+    initialize_ffmpeg();
+
+    AnalysisStats::StageTimer open_timer(stats ? &stats->stages[AnalysisStats::OPEN] : nullptr);
+
+    const DecodeDeadline deadline(options.max_seconds);
+    AVFormatContext* format_ctx_ptr = alloc_format_context(options, deadline);
+
+    // Open the file for decoding
+    if (avformat_open_input(&format_ctx_ptr, file_path, nullptr, nullptr) < 0)
+    {
+        deadline.check();
+        throw std::runtime_error("Unable to open audio file (File doesn't eixst or unhandle format)");
+    }
+
+    // Manage the format context. Instead of initalizing this before opening
+    // the input we handle it after since avformat_open_input will free the
+    // context for us upon error. Closing the input also closes the file and
+    // the demuxer, which a batch would otherwise run out of descriptors to.
+    std::shared_ptr<AVFormatContext> format_context(format_ctx_ptr,
+            [](AVFormatContext* c) { avformat_close_input(&c); });
+
+    decode_audio(format_ctx_ptr, options, handle_chunk, stats, sample_buffer, deadline, open_timer);
+}
+
+void fill_audio_data(const AudioSource &source, const DecodeOptions &options,
+        const audio_chunk_handler &handle_chunk, AnalysisStats::FileStats* stats,
+        std::vector<float>* sample_buffer)
+{
+    initialize_ffmpeg();
+
+    AnalysisStats::StageTimer open_timer(stats ? &stats->stages[AnalysisStats::OPEN] : nullptr);
+
+    // The buffer belongs to the AVIOContext, which may replace it, so both
+    // are freed through the context. The context outlives the format context
+    // reading from it.
+    const int buffer_size = options.io_buffer_size > 0 ? (int) options.io_buffer_size : SOURCE_BUFFER_SIZE;
+    auto io_buffer = (unsigned char*) av_malloc(buffer_size);
+
+    if (io_buffer == nullptr)
+        throw std::runtime_error("Unable to allocate the input buffer");
+
+    AVIOContext* io_ctx_ptr = avio_alloc_context(io_buffer, buffer_size, 0, (void*) &source,
+            &read_source, nullptr, source.seek ? &seek_source : nullptr);
+
+    if (io_ctx_ptr == nullptr)
+    {
+        av_free(io_buffer);
+        throw std::runtime_error("Unable to allocate the input context");
+    }
+
+    std::shared_ptr<AVIOContext> io_context(io_ctx_ptr, [](AVIOContext* context)
+    {
+        av_freep(&context->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+        avio_context_free(&context);
+#else
+        av_free(context);
+#endif
+    });
+
+    const DecodeDeadline deadline(options.max_seconds);
+    AVFormatContext* format_ctx_ptr = alloc_format_context(options, deadline);
+    format_ctx_ptr->pb = io_ctx_ptr;
+    format_ctx_ptr->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    if (avformat_open_input(&format_ctx_ptr, nullptr, nullptr, nullptr) < 0)
+    {
+        deadline.check();
+        throw std::runtime_error("Unable to open audio (Unhandled format)");
+    }
+
+    // Closing the input closes the demuxer but leaves the custom AVIOContext
+    // to its own owner
+    std::shared_ptr<AVFormatContext> format_context(format_ctx_ptr,
+            [](AVFormatContext* c) { avformat_close_input(&c); });
+
+    decode_audio(format_ctx_ptr, options, handle_chunk, stats, sample_buffer, deadline, open_timer);
+}
@@ -0,0 +1,292 @@
+#ifndef AUDIO_DECODER_H
+#define AUDIO_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <keyfinder/audiodata.h>
+
+#include "analysis_stats.h"
+
+struct AVFrame;
+struct SwrContext;
+
+// The number of audio frames decoded before a chunk is handed off to the
+// chromagram
+const unsigned int STREAM_CHUNK_FRAMES = 1 << 16;
+
+// The score margin the key must keep over the next best key to have converged
+const double DEFAULT_CONVERGE_MARGIN = 0.02;
+
+/**
+ * Options controlling how fill_audio_data decodes audio.
+ */
+struct DecodeOptions
+{
+    // Downmix to mono and decimate the audio while decoding, rather than
+    // leaving libkeyfinder to do it.
+    bool downmix = false;
+
+    // Only decode the audio from this many seconds into the stream
+    double start = 0;
+
+    // The number of seconds of audio to decode, 0 to decode until the end of
+    // the stream. When analyzing segments this is the length of each segment.
+    double duration = 0;
+
+    // The number of evenly spaced segments to decode, 0 to decode one
+    // continuous window of audio.
+    unsigned int segments = 0;
+
+    // Read files by mapping them into memory, rather than through the many
+    // small reads of the FFmpeg file protocol.
+    bool map_files = false;
+
+    // The size of the buffer files are read with, 0 to read them with the
+    // FFmpeg file protocol and its default buffer.
+    std::size_t io_buffer_size = 0;
+
+    // The number of threads decoders which support it decode a stream with,
+    // 0 to use one thread for each core.
+    unsigned int decode_threads = 1;
+
+    // Read and analyze only the start of a stream to find its parameters,
+    // which opens files faster but may estimate the durations of some
+    // streams less accurately.
+    bool fast_probe = false;
+
+    // Stop decoding once the key estimated by a KeyAnalyzer has stayed the
+    // same, with at least converge_margin between its score and the score of
+    // the next best key, for this many chunks in a row. 0 decodes the whole
+    // stream. fill_audio_data itself ignores these.
+    unsigned int converge_chunks = 0;
+    double converge_margin = DEFAULT_CONVERGE_MARGIN;
+
+    // Drop each decoded frame whose RMS level is below this many dBFS before
+    // it is handed off, 0 to keep every frame. Silent files then produce no
+    // chunks at all.
+    double silence_threshold = 0;
+
+    // Limits on decoding a single file, each 0 for no limit. A file which
+    // goes past one fails to decode with an error, rather than holding up
+    // everything after it. max_seconds limits the wall time taken to open
+    // and decode the file, max_duration the seconds of audio in the stream
+    // (by its header when it has one, otherwise as it is decoded), and
+    // max_samples the number of samples decoded across all channels.
+    double max_seconds = 0;
+    double max_duration = 0;
+    uint64_t max_samples = 0;
+};
+
+// The length of each segment when analyzing segments without a duration
+const double DEFAULT_SEGMENT_DURATION = 20;
+
+/**
+ * A window of a stream to decode, in seconds from the start of the stream.
+ */
+struct AnalysisWindow
+{
+    double begin;
+    double end;
+};
+
+/**
+ * Called with each chunk of audio decoded by fill_audio_data. The handler may
+ * take ownership of the chunk. Returning false stops decoding.
+ */
+typedef std::function<bool(KeyFinder::AudioData &chunk)> audio_chunk_handler;
+
+/**
+ * Somewhere encoded audio is read from other than a file, such as a memory
+ * buffer or a network stream.
+ */
+struct AudioSource
+{
+    // Read up to size bytes into the buffer, returning the number of bytes
+    // read, 0 at the end of the audio, or a negative AVERROR code.
+    std::function<int(uint8_t* buffer, int size)> read;
+
+    // Seek as fseek does, or return the total size when whence is
+    // AVSEEK_SIZE, returning a negative value when that isn't possible. May be
+    // left empty for sources which can't seek, which some formats need to
+    // find their stream information and which rules out seeking to the
+    // analysis windows.
+    std::function<int64_t(int64_t offset, int whence)> seek;
+};
+
+/**
+ * A seekable source reading from a buffer in memory. The buffer is not
+ * copied, it must outlive the source.
+ *
+ * @param data The encoded audio
+ * @param size The size of the encoded audio in bytes
+ */
+AudioSource memory_source(const uint8_t* data, std::size_t size);
+
+/**
+ * A source reading from a file descriptor until it ends. The source can seek
+ * when the file descriptor can, such as for regular files, but not for pipes
+ * or sockets.
+ */
+AudioSource file_descriptor_source(int fd);
+
+/**
+ * Ask the kernel to start reading a file into the page cache in the
+ * background, so that it is ready by the time it is decoded. Errors are
+ * ignored, the file is just decoded without being prefetched.
+ */
+void prefetch_file(const char* file_path);
+
+/**
+ * Determine the duration of the audio in a file from its container, without
+ * decoding any of it. Only the start of the file is probed, so this is cheap
+ * but may be inaccurate for some formats.
+ *
+ * @return The duration in seconds, 0 when it can't be determined
+ */
+double probe_duration(const char* file_path);
+
+/**
+ * Determine the lowest sample rate that audio can be decimated to before it
+ * is handed to libkeyfinder, while leaving the rate libkeyfinder ends up
+ * analyzing at unchanged.
+ *
+ * libkeyfinder low pass filters and downsamples audio by an integer factor
+ * before computing the chromagram. Decimating by a divisor of that factor
+ * beforehand leaves libkeyfinder with the remainder of the factor, resulting
+ * in the same analysis rate. At least a factor of two is left so that the
+ * libkeyfinder low pass filter still determines the frequencies analyzed.
+ * For example libkeyfinder downsamples 44.1kHz audio by a factor of 10, so
+ * it is decimated by 5 to 8820Hz, leaving libkeyfinder a factor of 2.
+ *
+ * @param sample_rate The sample rate of the decoded audio
+ */
+unsigned int decimated_sample_rate(unsigned int sample_rate);
+
+/**
+ * Determine the windows of a stream which should be decoded. An empty list
+ * means that the entire stream should be decoded.
+ *
+ * @param options         The decode options selecting the windows
+ * @param stream_duration The duration of the stream in seconds, or 0 when the
+ *                        duration isn't known
+ */
+std::vector<AnalysisWindow> analysis_windows(const DecodeOptions &options, double stream_duration);
+
+/**
+ * Check if decoded samples of the given format can be converted straight to
+ * interleaved floats by convert_samples, without using the resampler.
+ */
+bool is_direct_sample_format(int format);
+
+/**
+ * Convert the samples of a decoded 16 bit PCM or float frame, either planar or
+ * interleaved, into interleaved float samples.
+ *
+ * Samples are kept in the range of 16 bit PCM, which is the range the audio
+ * has always been analyzed in, so float samples are scaled up to it.
+ *
+ * @param frame    The decoded frame in one of the is_direct_sample_format formats
+ * @param channels The number of channels in the frame
+ * @param output   Room for nb_samples * channels interleaved samples
+ */
+void convert_samples(const AVFrame* frame, unsigned int channels, float* output);
+
+/**
+ * Set up a resampler converting decoded audio into interleaved float samples
+ * in a single pass, remixing it to the given number of channels. Audio keeps
+ * its channel layout when the number of channels stays the same, and is
+ * otherwise mixed into the default layout, mono when downmixing.
+ * libswresample picks the SIMD conversion, rematrixing and resampling paths
+ * of the CPU it runs on.
+ *
+ * @param format       The sample format of the decoded audio
+ * @param sample_rate  The sample rate of the decoded audio
+ * @param channels     The number of channels of the decoded audio
+ * @param layout       The channel layout mask of the decoded audio, 0 when it
+ *                     isn't known
+ * @param out_channels The number of channels to output
+ * @param out_rate     The sample rate to resample to
+ */
+std::shared_ptr<SwrContext> float_resampler(int format, int sample_rate, unsigned int channels,
+        uint64_t layout, unsigned int out_channels, int out_rate);
+
+/**
+ * Resample a decoded frame with a float_resampler, appending the converted
+ * samples to a buffer. The resampler writes straight into the buffer, so
+ * when the buffer only ever grows no memory is allocated for each frame.
+ * Samples are scaled into the range of 16 bit PCM, as by convert_samples.
+ *
+ * @param resampler The resampler set up for the frame
+ * @param frame     The decoded frame, or null to flush any samples buffered in
+ *                  the resampler
+ * @param channels  The number of channels the resampler outputs
+ * @param output    The buffer of interleaved samples to append to
+ */
+void resample_samples(SwrContext* resampler, const AVFrame* frame, unsigned int channels,
+        std::vector<float> &output);
+
+/**
+ * Check if a block of samples in the range of 16 bit PCM is silent, with an
+ * RMS level below the threshold. An empty block is never silent.
+ *
+ * @param samples   The samples to check
+ * @param count     The number of samples
+ * @param threshold The level in dBFS below which the block is silent
+ */
+bool is_silent(const float* samples, std::size_t count, double threshold);
+
+/**
+ * Append a contiguous block of interleaved samples to an AudioData object.
+ * The AudioData is grown and its write iterator positioned only once for the
+ * whole block, rather than once for each decoded frame.
+ *
+ * @param audio   The KeyFinder AudioData container to append to
+ * @param samples The interleaved samples to append
+ * @param count   The number of samples (not frames) to append
+ */
+void append_samples(KeyFinder::AudioData &audio, const float* samples, std::size_t count);
+
+/**
+ * Decode the audio data from a file into a series of KeyFinder::AudioData
+ * chunks of around STREAM_CHUNK_FRAMES frames each. This does the ffmpeg dance
+ * to decode any type of audio stream into float samples, handing each chunk
+ * off as soon as it has been filled so the whole file never has to be held in
+ * memory at once.
+ *
+ * @param file_path     The file to read audio data from, - to read standard
+ *                      input
+ * @param options       Options controlling how the audio is decoded
+ * @param handle_chunk  Called with each chunk of decoded audio
+ * @param stats         When given, the time spent in each decoding stage is
+ *                      added to it along with the amount of audio decoded
+ * @param sample_buffer When given, decoded samples are collected in it
+ *                      rather than in a buffer allocated for each file, so
+ *                      a caller decoding many files reuses the same memory
+ */
+void fill_audio_data(const char* file_path, const DecodeOptions &options,
+        const audio_chunk_handler &handle_chunk, AnalysisStats::FileStats* stats = nullptr,
+        std::vector<float>* sample_buffer = nullptr);
+
+/**
+ * Decode the audio data read from a source, as fill_audio_data does for a
+ * file. The source is read through a custom AVIOContext, so the encoded
+ * audio never has to be written to disk first. The source is only used until
+ * this returns.
+ *
+ * @param source        The source to read encoded audio data from
+ * @param options       Options controlling how the audio is decoded
+ * @param handle_chunk  Called with each chunk of decoded audio
+ * @param stats         When given, the time spent in each decoding stage is
+ *                      added to it along with the amount of audio decoded
+ * @param sample_buffer When given, decoded samples are collected in it
+ *                      rather than in a buffer allocated for each file, so
+ *                      a caller decoding many files reuses the same memory
+ */
+void fill_audio_data(const AudioSource &source, const DecodeOptions &options,
+        const audio_chunk_handler &handle_chunk, AnalysisStats::FileStats* stats = nullptr,
+        std::vector<float>* sample_buffer = nullptr);
+
+#endif
@@ -0,0 +1,373 @@
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <keyfinder/keyfinder.h>
+#include <keyfinder/constants.h>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+#include <libavcodec/avcodec.h>
+}
+
+#include "analysis_stats.h"
+#include "audio_decoder.h"
+#include "key_scoring.h"
+
+// Synthetic audio used by the micro benchmarks, in frames
+const unsigned int BENCH_SAMPLE_RATE = 44100;
+const unsigned int BENCH_CHANNELS    = 2;
+const unsigned int BENCH_FRAME_SIZE  = 1152;
+const double       BENCH_SECONDS     = 60;
+
+// The number of random chromagrams scored by the key scoring benchmark
+const unsigned int BENCH_CHROMAGRAMS = 20000;
+
+/**
+ * Time a function, repeating it until at least half a second has passed so
+ * that short runs are measured reliably.
+ *
+ * @return the wall time of a single run in seconds
+ */
+double time_runs(const std::function<void()> &run)
+{
+    typedef std::chrono::steady_clock clock;
+
+    run();
+
+    unsigned int runs = 0;
+    const auto started = clock::now();
+    std::chrono::duration<double> elapsed;
+
+    do
+    {
+        run();
+        ++runs;
+        elapsed = clock::now() - started;
+    }
+    while (elapsed.count() < 0.5);
+
+    return elapsed.count() / runs;
+}
+
+/**
+ * Write the result of a benchmark processing the given seconds of audio.
+ */
+void report(const std::string &name, double seconds, double audio_seconds)
+{
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+              << std::setprecision(3) << std::setw(10) << seconds * 1000 << " ms"
+              << std::setprecision(1) << std::setw(10) << audio_seconds / seconds << "x realtime"
+              << '\n';
+}
+
+/**
+ * Allocate a frame of synthetic audio: a chord of sine waves in the given
+ * sample format.
+ */
+std::shared_ptr<AVFrame> synthetic_frame(AVSampleFormat format, unsigned int frames)
+{
+    std::shared_ptr<AVFrame> frame(av_frame_alloc(), [](AVFrame* f) { av_frame_free(&f); });
+
+    frame->format         = format;
+    frame->nb_samples     = frames;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100)
+    av_channel_layout_default(&frame->ch_layout, BENCH_CHANNELS);
+#else
+    frame->channel_layout = av_get_default_channel_layout(BENCH_CHANNELS);
+#endif
+    frame->sample_rate    = BENCH_SAMPLE_RATE;
+
+    if (av_frame_get_buffer(frame.get(), 0) < 0)
+        throw std::runtime_error("Unable to allocate a frame");
+
+    const bool planar = av_sample_fmt_is_planar(format);
+
+    for (unsigned int i = 0; i < frames; ++i)
+    {
+        const double t = i / (double) BENCH_SAMPLE_RATE;
+        const double value = (std::sin(2 * M_PI * 220 * t) + std::sin(2 * M_PI * 277.18 * t)
+                + std::sin(2 * M_PI * 329.63 * t)) / 4;
+
+        for (unsigned int c = 0; c < BENCH_CHANNELS; ++c)
+        {
+            const unsigned int plane = planar ? c : 0;
+            const unsigned int index = planar ? i : i * BENCH_CHANNELS + c;
+
+            if (format == AV_SAMPLE_FMT_S16 || format == AV_SAMPLE_FMT_S16P)
+                ((int16_t*) frame->extended_data[plane])[index] = (int16_t) (value * 32767);
+            else
+                ((float*) frame->extended_data[plane])[index] = (float) value;
+        }
+    }
+
+    return frame;
+}
+
+/**
+ * Convert decoded frames of each of the directly supported sample formats
+ * into float samples.
+ */
+void bench_convert()
+{
+    const unsigned int frames = BENCH_SECONDS * BENCH_SAMPLE_RATE / BENCH_FRAME_SIZE;
+    const double audio_seconds = frames * BENCH_FRAME_SIZE / (double) BENCH_SAMPLE_RATE;
+
+    const AVSampleFormat formats[] = {
+        AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP,
+    };
+
+    std::vector<float> output(BENCH_FRAME_SIZE * BENCH_CHANNELS);
+
+    for (const auto format : formats)
+    {
+        const auto frame = synthetic_frame(format, BENCH_FRAME_SIZE);
+
+        const double seconds = time_runs([&]()
+        {
+            for (unsigned int i = 0; i < frames; ++i)
+                convert_samples(frame.get(), BENCH_CHANNELS, output.data());
+        });
+
+        report(std::string("convert ") + av_get_sample_fmt_name(format), seconds, audio_seconds);
+    }
+}
+
+/**
+ * Fill an AudioData with a minute of audio, one decoded frame at a time as
+ * was done before samples were appended in bulk, and with append_samples.
+ */
+void bench_append()
+{
+    const unsigned int frames = BENCH_SECONDS * BENCH_SAMPLE_RATE / BENCH_FRAME_SIZE;
+    const unsigned int frame_samples = BENCH_FRAME_SIZE * BENCH_CHANNELS;
+    const double audio_seconds = frames * BENCH_FRAME_SIZE / (double) BENCH_SAMPLE_RATE;
+
+    std::vector<float> samples((std::size_t) frames * frame_samples, 0.25f);
+
+    const double per_frame = time_runs([&]()
+    {
+        KeyFinder::AudioData audio;
+        audio.setFrameRate(BENCH_SAMPLE_RATE);
+        audio.setChannels(BENCH_CHANNELS);
+
+        for (unsigned int i = 0; i < frames; ++i)
+        {
+            const unsigned int offset = audio.getSampleCount();
+
+            audio.addToSampleCount(frame_samples);
+            audio.resetIterators();
+            audio.advanceWriteIterator(offset);
+
+            for (unsigned int j = 0; j < frame_samples; ++j)
+            {
+                audio.setSampleAtWriteIterator(samples[(std::size_t) i * frame_samples + j]);
+                audio.advanceWriteIterator();
+            }
+        }
+    });
+
+    const double bulk = time_runs([&]()
+    {
+        KeyFinder::AudioData audio;
+        audio.setFrameRate(BENCH_SAMPLE_RATE);
+        audio.setChannels(BENCH_CHANNELS);
+
+        append_samples(audio, samples.data(), samples.size());
+    });
+
+    report("append per frame", per_frame, audio_seconds);
+    report("append bulk", bulk, audio_seconds);
+}
+
+/**
+ * Resample a minute of planar float audio into interleaved floats, both at
+ * the same rate and downmixed and decimated as --downmix does.
+ */
+void bench_resample()
+{
+    const unsigned int frames = BENCH_SECONDS * BENCH_SAMPLE_RATE / BENCH_FRAME_SIZE;
+    const double audio_seconds = frames * BENCH_FRAME_SIZE / (double) BENCH_SAMPLE_RATE;
+
+    const auto frame = synthetic_frame(AV_SAMPLE_FMT_FLTP, BENCH_FRAME_SIZE);
+
+    for (const bool downmix : {false, true})
+    {
+        const int out_rate = downmix ? decimated_sample_rate(BENCH_SAMPLE_RATE) : BENCH_SAMPLE_RATE;
+        const int out_channels = downmix ? 1 : BENCH_CHANNELS;
+
+        std::vector<float> output;
+
+        const double seconds = time_runs([&]()
+        {
+            const auto resampler = float_resampler(AV_SAMPLE_FMT_FLTP, BENCH_SAMPLE_RATE,
+                    BENCH_CHANNELS, 0, out_channels, out_rate);
+
+            for (unsigned int i = 0; i < frames; ++i)
+            {
+                output.clear();
+                resample_samples(resampler.get(), frame.get(), out_channels, output);
+            }
+        });
+
+        report(downmix ? "resample downmix" : "resample", seconds, audio_seconds);
+    }
+}
+
+/**
+ * Estimate the keys of random chromagrams with KeyScoring and with
+ * libkeyfinder, checking that both agree.
+ */
+void bench_scoring()
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> distribution(0, 1);
+
+    auto random_vector = [&](std::size_t size)
+    {
+        std::vector<double> values(size);
+
+        for (auto &value : values)
+            value = distribution(random);
+
+        return values;
+    };
+
+    const auto major = random_vector(KeyScoring::BANDS);
+    const auto minor = random_vector(KeyScoring::BANDS);
+
+    std::vector<std::vector<double>> chromagrams;
+    for (unsigned int i = 0; i < BENCH_CHROMAGRAMS; ++i)
+        chromagrams.push_back(random_vector(KeyScoring::BANDS));
+
+    const KeyScoring::KeyScorer scorer(major, minor);
+    KeyFinder::KeyFinder key_finder;
+
+    std::vector<KeyFinder::key_t> scorer_keys(chromagrams.size());
+    std::vector<KeyFinder::key_t> keyfinder_keys(chromagrams.size());
+
+    const double scorer_seconds = time_runs([&]()
+    {
+        KeyScoring::Scores scores;
+
+        for (std::size_t i = 0; i < chromagrams.size(); ++i)
+        {
+            scorer.score(chromagrams[i].data(), scores);
+            scorer_keys[i] = KeyScoring::KeyScorer::best_key(scores);
+        }
+    });
+
+    const double keyfinder_seconds = time_runs([&]()
+    {
+        for (std::size_t i = 0; i < chromagrams.size(); ++i)
+            keyfinder_keys[i] = key_finder.keyOfChromaVector(chromagrams[i], major, minor);
+    });
+
+    unsigned int disagreements = 0;
+    for (std::size_t i = 0; i < chromagrams.size(); ++i)
+        disagreements += scorer_keys[i] != keyfinder_keys[i];
+
+    std::cout << std::left << std::fixed << std::setprecision(0)
+              << std::setw(28) << "score KeyScoring" << std::right
+              << std::setw(10) << chromagrams.size() / scorer_seconds << " chromagrams/s" << '\n'
+              << std::left << std::setw(28) << "score keyOfChromaVector" << std::right
+              << std::setw(10) << chromagrams.size() / keyfinder_seconds << " chromagrams/s" << '\n'
+              << std::left << std::setw(28) << "score disagreements" << std::right
+              << std::setw(10) << disagreements << " of " << chromagrams.size() << '\n';
+}
+
+/**
+ * Decode each file with fill_audio_data, and build its chromagram, writing
+ * the realtime factor and the time spent in each stage.
+ */
+void bench_files(const std::vector<std::string> &file_paths, const DecodeOptions &options)
+{
+    KeyFinder::KeyFinder key_finder;
+    AnalysisStats::Summary summary;
+
+    const auto started = std::chrono::steady_clock::now();
+
+    for (const auto &file_path : file_paths)
+    {
+        AnalysisStats::FileStats stats;
+        const auto file_started = std::chrono::steady_clock::now();
+
+        try
+        {
+            KeyFinder::Workspace workspace;
+
+            fill_audio_data(file_path.c_str(), options, [&](KeyFinder::AudioData &chunk)
+            {
+                AnalysisStats::StageTimer timer(&stats.stages[AnalysisStats::CHROMAGRAM]);
+                key_finder.progressiveChromagram(std::move(chunk), workspace);
+
+                return true;
+            }, &stats);
+
+            AnalysisStats::StageTimer timer(&stats.stages[AnalysisStats::FINAL]);
+            key_finder.finalChromagram(workspace);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << file_path << ": " << e.what() << std::endl;
+            continue;
+        }
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file_started).count();
+        stats.peak_rss_kb = AnalysisStats::peak_rss_kb();
+
+        AnalysisStats::write_file(std::cout, file_path, stats);
+        summary.add(stats);
+    }
+
+    summary.write(std::cout, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+}
+
+int main(int argc, char** argv)
+{
+    DecodeOptions decode_options;
+
+    int c;
+    while ((c = getopt(argc, argv, "dh")) != -1)
+    {
+        switch (c)
+        {
+        case 'd':
+            decode_options.downmix = true;
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0] << " [-d] [audio-file...]" << std::endl;
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    av_log_set_callback([](void *, int, const char*, va_list) {});
+
+    try
+    {
+        bench_convert();
+        bench_append();
+        bench_resample();
+        bench_scoring();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    const std::vector<std::string> file_paths(argv + optind, argv + argc);
+
+    if ( ! file_paths.empty())
+        bench_files(file_paths, decode_options);
+
+    std::cout.flush();
+    return 0;
+}
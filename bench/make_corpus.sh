@@ -0,0 +1,146 @@
+#!/bin/sh
+#
+# Generate a synthetic audio corpus for benchmarking, using the ffmpeg command
+# line tool. Every file holds a I-IV-V-I chord progression in a known key, and
+# the files cover a range of codecs, lengths, channel counts and sample rates,
+# along with a stream whose channels and sample rate change part way through.
+# The expected key of each file is written to expected.tsv in the corpus.
+#
+# Files which already exist are left alone, so the corpus is only generated
+# once and stays the same between runs.
+#
+# Usage: make_corpus.sh [corpus-dir]
+#
+# The lengths (in seconds) of the generated files can be set with
+# BENCH_LENGTHS, for example BENCH_LENGTHS="30 240 600".
+
+set -e
+
+corpus=${1:-bench/corpus}
+lengths=${BENCH_LENGTHS:-30 240}
+
+rates="22050 44100 48000 96000"
+channel_counts="1 2 6"
+
+# Standard key notation of the keys, in the order of their tonic from A
+major_keys="A Bb B C Db D Eb E F Gb G Ab"
+minor_keys="Am Bbm Bm Cm Dbm Dm Ebm Em Fm Gbm Gm Abm"
+
+# codec name, file extension, encoder and encoder options
+codecs="
+wav-s16 wav pcm_s16le
+wav-f32 wav pcm_f32le
+flac flac flac
+mp3 mp3 libmp3lame -b:a 192k
+vorbis ogg libvorbis -q:a 5
+aac m4a aac -b:a 192k
+opus opus libopus -b:a 128k
+"
+
+if ! command -v ffmpeg > /dev/null; then
+    echo "ffmpeg is needed to generate the benchmark corpus" >&2
+    exit 1
+fi
+
+mkdir -p "$corpus"
+
+encoders=$(ffmpeg -hide_banner -encoders 2> /dev/null)
+expected="$corpus/expected.tsv"
+: > "$expected.tmp"
+
+# Build the aevalsrc expression of the progression in a key, with each chord
+# lasting two seconds. Chords are triads a fifth apart above the tonic, along
+# with their root an octave lower.
+progression() {
+    awk -v tonic="$1" -v minor="$2" 'BEGIN {
+        third = minor ? 3 : 4
+        split("0 5 7 0", roots, " ")
+
+        for (i = 1; i <= 4; ++i) {
+            root = tonic + roots[i]
+            chord_third = (i == 3) ? 4 : third
+            steps[1] = root; steps[2] = root + chord_third; steps[3] = root + 7; steps[4] = root - 12
+
+            chord = ""
+            for (j = 1; j <= 4; ++j) {
+                frequency = 220 * 2 ^ (steps[j] / 12)
+                chord = chord (j > 1 ? "+" : "") sprintf("sin(2*PI*%.4f*t)", frequency)
+            }
+
+            chords[i] = "(" chord ")/5"
+        }
+
+        printf "if(lt(mod(t,8),2),%s,if(lt(mod(t,8),4),%s,if(lt(mod(t,8),6),%s,%s)))",
+            chords[1], chords[2], chords[3], chords[4]
+    }'
+}
+
+index=0
+
+echo "$codecs" | while read -r name extension encoder options; do
+    [ -n "$name" ] || continue
+
+    if ! echo "$encoders" | grep -q " $encoder "; then
+        echo "Skipping $name, ffmpeg has no $encoder encoder" >&2
+        continue
+    fi
+
+    for length in $lengths; do
+        for channels in $channel_counts; do
+            index=$((index + 1))
+
+            # Rotate through the keys and sample rates so every combination
+            # of codec, length and channels gets a different one
+            tonic=$((index % 12))
+            minor=$(((index / 12) % 2))
+            rate=$(echo $rates | cut -d' ' -f$((index % 4 + 1)))
+
+            keys=$major_keys
+            [ $minor -eq 1 ] && keys=$minor_keys
+
+            key=$(echo $keys | cut -d' ' -f$((tonic + 1)))
+
+            # Opus only encodes at 48kHz and MP3 holds at most two channels
+            [ "$name" = opus ] && rate=48000
+            [ "$name" = mp3 ] && [ $channels -gt 2 ] && channels=2
+
+            file="$corpus/$name-${length}s-${channels}ch-${rate}hz-$key.$extension"
+
+            if [ ! -e "$file" ]; then
+                echo "Generating $file" >&2
+
+                ffmpeg -v error -y -f lavfi \
+                    -i "aevalsrc='$(progression $tonic $minor)':s=$rate:d=$length" \
+                    -ac "$channels" -c:a "$encoder" $options "$file.tmp.$extension"
+
+                mv "$file.tmp.$extension" "$file"
+            fi
+
+            printf '%s\t%s\n' "$file" "$key" >> "$expected.tmp"
+        done
+    done
+done
+
+# Concatenated ADTS streams play as one stream, which changes from mono at
+# 44.1kHz to stereo at 48kHz half way through, so that the decoder has to
+# convert frames of more than one format
+key=E
+file="$corpus/aac-changing-1ch-44100hz-2ch-48000hz-$key.aac"
+
+if [ ! -e "$file" ]; then
+    echo "Generating $file" >&2
+
+    for part in 1:44100 2:48000; do
+        ffmpeg -v error -y -f lavfi \
+            -i "aevalsrc='$(progression 7 0)':s=${part#*:}:d=30" \
+            -ac "${part%:*}" -c:a aac -b:a 192k -f adts "$file.tmp.${part%:*}"
+    done
+
+    cat "$file.tmp.1" "$file.tmp.2" > "$file.tmp"
+    rm "$file.tmp.1" "$file.tmp.2"
+    mv "$file.tmp" "$file"
+fi
+
+printf '%s\t%s\n' "$file" "$key" >> "$expected.tmp"
+
+mv "$expected.tmp" "$expected"
@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+# Analyze the benchmark corpus end to end with keyfinder-cli, reporting the
+# --stats summary of each run, the accuracy of the estimated keys against the
+# expected keys, and how often the faster analysis options agree with the
+# full analysis of every file. Fails when a file whose format changes part way
+# through doesn't decode to the expected key with every option.
+#
+# Usage: run_e2e.sh [corpus-dir] [keyfinder-cli]
+#
+# Extra options for every run, such as the number of jobs, can be passed with
+# BENCH_OPTIONS, for example BENCH_OPTIONS="-J 0".
+
+set -e
+
+corpus=${1:-bench/corpus}
+keyfinder_cli=${2:-./keyfinder-cli}
+expected="$corpus/expected.tsv"
+
+if [ ! -e "$expected" ]; then
+    echo "No corpus in $corpus, generate one with bench/make_corpus.sh" >&2
+    exit 1
+fi
+
+results=$(mktemp -d)
+trap 'rm -rf "$results"' EXIT
+
+cut -f1 "$expected" > "$results/files"
+
+# Analyze the corpus with the given options, writing the results to
+# $results/<name>.tsv and the stats summary to stdout
+run() {
+    name=$1
+    shift
+
+    echo "== $name: $*"
+
+    # The per-file stats lines hold a colon after the path, the summary doesn't
+    "$keyfinder_cli" --format tsv --stats $BENCH_OPTIONS "$@" -f "$results/files" \
+        > "$results/$name.tsv" 2> "$results/$name.stats" || true
+
+    grep -v '^stats: .*:' "$results/$name.stats" || true
+}
+
+# Compare the standard notation keys of a run with a list of expected keys
+# for each path
+compare() {
+    awk -F '\t' -v label="$3" '
+        NR == FNR { key[$1] = $2; next }
+        FNR > 1 && ($1 in key) { ++total; matched += $6 == key[$1] }
+        END { printf "%s: %d of %d (%.1f%%)\n", label, matched, total, total ? 100 * matched / total : 0 }
+    ' "$1" "$2"
+}
+
+run full
+run downmix -d
+run segments --segments 4
+run window --duration 30
+
+awk -F '\t' 'BEGIN { OFS = "\t" } FNR > 1 { print $1, $6 }' "$results/full.tsv" > "$results/full.keys"
+
+echo "== accuracy"
+for name in full downmix segments window; do
+    compare "$expected" "$results/$name.tsv" "$name matches the expected key"
+done
+
+echo "== agreement with the full analysis"
+for name in downmix segments window; do
+    compare "$results/full.keys" "$results/$name.tsv" "$name agrees"
+done
+
+echo "== format changes"
+failed=0
+for name in full downmix segments window; do
+    awk -F '\t' -v label="$name" '
+        NR == FNR { key[$1] = $2; next }
+        FNR > 1 && $1 ~ /-changing-/ && ($3 != "ok" || $6 != key[$1]) {
+            printf "%s: %s gave %s\n", label, $1, $3 == "ok" ? $6 : $NF
+            failed = 1
+        }
+        END { exit failed }
+    ' "$expected" "$results/$name.tsv" || failed=1
+done
+
+[ $failed -eq 0 ] && echo "every file changing format decoded to its key"
+exit $failed
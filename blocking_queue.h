@@ -0,0 +1,84 @@
+#ifndef BLOCKING_QUEUE_H
+#define BLOCKING_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+ * A thread safe FIFO queue. When a capacity is given pushing blocks while the
+ * queue is full. Once the queue has been closed no more items may be pushed,
+ * and popping fails as soon as the remaining items have been drained.
+ */
+template<typename T>
+class BlockingQueue
+{
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed = false;
+
+public:
+    /**
+     * @param capacity The maximum number of queued items, 0 for no limit
+     */
+    explicit BlockingQueue(std::size_t capacity = 0) : capacity(capacity) {}
+
+    /**
+     * @return false if the queue was closed and the item was not queued
+     */
+    bool push(T item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [this]()
+            {
+                return closed || capacity == 0 || items.size() < capacity;
+            });
+
+            if (closed)
+                return false;
+
+            items.push_back(std::move(item));
+        }
+
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * @return false if the queue was closed and has no items left
+     */
+    bool pop(T &item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [this]() { return closed || ! items.empty(); });
+
+            if (items.empty())
+                return false;
+
+            item = std::move(items.front());
+            items.pop_front();
+        }
+
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+#endif
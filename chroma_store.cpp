@@ -0,0 +1,108 @@
+#include "chroma_store.h"
+#include "key_scoring.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char MAGIC[8] = {'K', 'F', 'C', 'H', 'R', 'O', 'M', 'A'};
+    const uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t bands;
+    };
+
+    template<typename T>
+    void put(std::string &buffer, const T &value)
+    {
+        buffer.append((const char*) &value, sizeof(value));
+    }
+}
+
+ChromaStore::Writer::Writer(const std::string &store_path)
+{
+    store_fd = open(store_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (store_fd < 0)
+        throw std::runtime_error("Unable to open the chromagram store " + store_path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    struct stat store_stat;
+
+    if (fstat(store_fd, &store_stat) < 0 || store_stat.st_size > 0)
+        return;
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.bands = KeyScoring::BANDS;
+
+    if (::write(store_fd, &header, sizeof(header)) != sizeof(header))
+    {
+        close(store_fd);
+        throw std::runtime_error("Unable to write the chromagram store " + store_path);
+    }
+}
+
+ChromaStore::Writer::~Writer()
+{
+    close(store_fd);
+}
+
+void ChromaStore::Writer::write(const std::string &file_path, const std::vector<double> &chromagram)
+{
+    if (chromagram.size() != KeyScoring::BANDS)
+        throw std::runtime_error("Unexpected number of chromagram bands");
+
+    std::string record;
+    record.reserve(sizeof(uint32_t) + file_path.size() + chromagram.size() * sizeof(double));
+
+    put(record, (uint32_t) file_path.size());
+    record.append(file_path);
+    record.append((const char*) chromagram.data(), chromagram.size() * sizeof(double));
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (::write(store_fd, record.data(), record.size()) != (ssize_t) record.size())
+        throw std::runtime_error("Unable to write to the chromagram store");
+}
+
+ChromaStore::Reader::Reader(const std::string &store_path)
+    : store_file(store_path, std::ios::binary)
+{
+    if ( ! store_file)
+        throw std::runtime_error("Unable to open the chromagram store " + store_path);
+
+    Header header;
+
+    if ( ! store_file.read((char*) &header, sizeof(header))
+            || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION)
+        throw std::runtime_error("Not a chromagram store " + store_path);
+
+    bands = header.bands;
+}
+
+bool ChromaStore::Reader::next(std::string &file_path, std::vector<double> &chromagram)
+{
+    uint32_t path_length;
+
+    if ( ! store_file.read((char*) &path_length, sizeof(path_length)))
+        return false;
+
+    file_path.resize(path_length);
+    chromagram.resize(bands);
+
+    if ( ! store_file.read(&file_path[0], path_length)
+            || ! store_file.read((char*) chromagram.data(), bands * sizeof(double)))
+        throw std::runtime_error("Truncated chromagram store");
+
+    return true;
+}
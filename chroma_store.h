@@ -0,0 +1,63 @@
+#ifndef CHROMA_STORE_H
+#define CHROMA_STORE_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * A compact binary store of collapsed chromagrams, one for each analyzed file.
+ * Storing the chromagrams allows keys to be re-estimated with different tone
+ * profiles without decoding any audio.
+ *
+ * The store begins with a short header identifying the format and the number
+ * of bands in each chromagram, followed by one record for each file: the
+ * length of the path, the path itself, and the chromagram as doubles. All
+ * values are stored in native byte order.
+ */
+namespace ChromaStore
+{
+    /**
+     * Appends chromagrams to a store, creating the store if needed. Records
+     * are written with a single write each so that writers never interleave.
+     */
+    class Writer
+    {
+    public:
+        explicit Writer(const std::string &store_path);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        void write(const std::string &file_path, const std::vector<double> &chromagram);
+
+    private:
+        std::mutex mutex;
+        int store_fd;
+    };
+
+    /**
+     * Reads the chromagrams from a store, in the order they were written.
+     */
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string &store_path);
+
+        /**
+         * Read the next chromagram in the store.
+         *
+         * @return false once there are no chromagrams left
+         */
+        bool next(std::string &file_path, std::vector<double> &chromagram);
+
+    private:
+        std::ifstream store_file;
+        uint32_t bands;
+    };
+}
+
+#endif
@@ -0,0 +1,238 @@
+#include "key_analyzer.h"
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <thread>
+#include <dlfcn.h>
+
+#include "blocking_queue.h"
+#include "result_cache.h"
+
+// The number of decoded chunks allowed to be waiting for the chromagram
+const unsigned int STREAM_QUEUE_DEPTH = 4;
+
+// Identifies the key scoring implementation in cached results, bump this
+// whenever a change to KeyScoring may change estimated keys
+const unsigned int KEY_SCORING_VERSION = 1;
+
+KeyAnalyzer::KeyAnalyzer(const DecodeOptions &options, std::vector<ToneProfileSet> profile_sets)
+    : options(options), sets(std::move(profile_sets))
+{
+    if (sets.empty())
+        sets.push_back(toneProfileSet("default", MAJOR_PROFILE, MINOR_PROFILE));
+}
+
+std::vector<double> KeyAnalyzer::chromagram(const std::string &file_path, AnalysisStats::FileStats* stats)
+{
+    return build_chromagram([&](const audio_chunk_handler &handle_chunk)
+    {
+        fill_audio_data(file_path.c_str(), options, handle_chunk, stats, &samples);
+    }, stats);
+}
+
+std::vector<double> KeyAnalyzer::chromagram(const AudioSource &source, AnalysisStats::FileStats* stats)
+{
+    return build_chromagram([&](const audio_chunk_handler &handle_chunk)
+    {
+        fill_audio_data(source, options, handle_chunk, stats, &samples);
+    }, stats);
+}
+
+std::vector<double> KeyAnalyzer::build_chromagram(const decode_function &decode, AnalysisStats::FileStats* stats)
+{
+    auto stage = [stats](AnalysisStats::Stage stage)
+    {
+        return stats ? &stats->stages[stage] : nullptr;
+    };
+
+    reset_workspace();
+
+    BlockingQueue<KeyFinder::AudioData> chunks(STREAM_QUEUE_DEPTH);
+    std::exception_ptr chromagram_error;
+
+    // The sum of every hop of the chromagram so far, which scores the same as
+    // the collapsed chromagram, along with how long the key it scores as has
+    // been stable for
+    std::vector<double> running_chromagram(KeyScoring::BANDS, 0.0);
+    unsigned int summed_hops = 0;
+    KeyFinder::key_t stable_key = KeyFinder::SILENCE;
+    unsigned int stable_chunks = 0;
+
+    // Check if the key estimated from the chromagram so far has converged
+    auto converged = [&]()
+    {
+        const auto chromagram = workspace.chromagram;
+
+        if (options.converge_chunks == 0 || chromagram == nullptr)
+            return false;
+
+        const unsigned int bands = std::min<std::size_t>(chromagram->getBands(), KeyScoring::BANDS);
+
+        for (; summed_hops < chromagram->getHops(); ++summed_hops)
+        {
+            for (unsigned int band = 0; band < bands; ++band)
+                running_chromagram[band] += chromagram->getMagnitude(summed_hops, band);
+        }
+
+        KeyScoring::Scores scores;
+        sets.front().scorer.score(running_chromagram.data(), scores);
+
+        const auto ranked = KeyScoring::KeyScorer::ranked_keys(scores);
+
+        if (scores[ranked[0]] <= 0 || scores[ranked[0]] - scores[ranked[1]] < options.converge_margin)
+        {
+            stable_chunks = 0;
+            return false;
+        }
+
+        stable_chunks = ranked[0] == stable_key ? stable_chunks + 1 : 1;
+        stable_key = ranked[0];
+
+        return stable_chunks >= options.converge_chunks;
+    };
+
+    std::thread chromagram_thread([&]()
+    {
+        KeyFinder::AudioData chunk;
+
+        try
+        {
+            while (chunks.pop(chunk))
+            {
+                AnalysisStats::StageTimer timer(stage(AnalysisStats::CHROMAGRAM));
+                key_finder.progressiveChromagram(std::move(chunk), workspace);
+
+                // Once the key has settled the decoder is stopped, and the
+                // chunks it already queued are left out
+                if (converged())
+                {
+                    chunks.close();
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            // Stop the decoder from queueing any more chunks
+            chromagram_error = std::current_exception();
+            chunks.close();
+        }
+    });
+
+    try
+    {
+        decode([&](KeyFinder::AudioData &chunk)
+        {
+            return chunks.push(std::move(chunk));
+        });
+    }
+    catch (...)
+    {
+        chunks.close();
+        chromagram_thread.join();
+        throw;
+    }
+
+    chunks.close();
+    chromagram_thread.join();
+
+    if (chromagram_error)
+        std::rethrow_exception(chromagram_error);
+
+    AnalysisStats::StageTimer final_timer(stage(AnalysisStats::FINAL));
+
+    key_finder.finalChromagram(workspace);
+
+    // Files without any audio have no chromagram at all
+    if (workspace.chromagram == nullptr)
+        return std::vector<double>(KeyScoring::BANDS, 0.0);
+
+    return workspace.chromagram->collapseToOneHop();
+}
+
+void KeyAnalyzer::reset_workspace()
+{
+    // The FFT plan and buffers, along with the low pass filter buffer, only
+    // depend on the analysis parameters and are kept. Everything else holds
+    // the audio of the last file.
+    delete workspace.chromagram;
+    workspace.chromagram = nullptr;
+
+    workspace.preprocessBuffer = KeyFinder::AudioData();
+    workspace.remainderBuffer = KeyFinder::AudioData();
+}
+
+void KeyAnalyzer::score(const std::vector<double> &chromagram, std::vector<KeyFinder::key_t> &keys,
+        std::vector<KeyScoring::Scores> &scores) const
+{
+    if (chromagram.size() != KeyScoring::BANDS)
+        throw std::runtime_error("Unexpected number of chromagram bands");
+
+    keys.clear();
+    scores.resize(sets.size());
+
+    for (std::size_t i = 0; i < sets.size(); ++i)
+    {
+        sets[i].scorer.score(chromagram.data(), scores[i]);
+        keys.push_back(KeyScoring::KeyScorer::best_key(scores[i]));
+    }
+}
+
+KeyFinder::key_t KeyAnalyzer::key_of_file(const std::string &file_path)
+{
+    return sets.front().scorer.key_of(chromagram(file_path));
+}
+
+std::string KeyAnalyzer::parameters(std::size_t set) const
+{
+    std::ostringstream parameters;
+    parameters.precision(17);
+
+    parameters << "keyfinder=" << keyfinder_library_id()
+               << " scoring="  << KEY_SCORING_VERSION
+               << " downmix="  << options.downmix
+               << " start="    << options.start
+               << " duration=" << options.duration
+               << " segments=" << options.segments;
+
+    // Probing quickly may change the stream duration the analysis windows
+    // are placed by, and converging or gating silence the audio analyzed.
+    // These are left out otherwise so that results cached before they
+    // existed stay valid.
+    if (options.fast_probe)
+        parameters << " fast_probe=1";
+
+    if (options.converge_chunks > 0)
+        parameters << " converge=" << options.converge_chunks << ',' << options.converge_margin;
+
+    if (options.silence_threshold < 0)
+        parameters << " silence=" << options.silence_threshold;
+
+    parameters << " major=";
+    for (const auto value : sets[set].major)
+        parameters << value << ',';
+
+    parameters << " minor=";
+    for (const auto value : sets[set].minor)
+        parameters << value << ',';
+
+    return parameters.str();
+}
+
+std::string keyfinder_library_id()
+{
+    Dl_info info;
+    ResultCache::FileStamp stamp;
+
+    if (dladdr((void*) &KeyFinder::getLastFrequency, &info) == 0 || info.dli_fname == nullptr)
+        return "unknown";
+
+    if ( ! ResultCache::stamp(info.dli_fname, stamp))
+        return info.dli_fname;
+
+    std::ostringstream id;
+    id << info.dli_fname << ':' << stamp.size << ':' << stamp.mtime;
+
+    return id.str();
+}
@@ -0,0 +1,127 @@
+#ifndef KEY_ANALYZER_H
+#define KEY_ANALYZER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <keyfinder/keyfinder.h>
+
+#include "analysis_stats.h"
+#include "audio_decoder.h"
+#include "key_scoring.h"
+#include "tone_profiles.h"
+
+/**
+ * Estimates the keys of audio files, for embedding the analysis in other
+ * programs rather than running keyfinder-cli for each file.
+ *
+ * An analyzer owns the KeyFinder instance and the Workspace used for every
+ * file it analyzes, so the FFT and temporal window caches libkeyfinder builds
+ * up, the FFT plan and buffers of the workspace, and the buffer decoded
+ * samples are collected in, are only computed once.
+ * An analyzer must only be used by one thread at a time; analyzing files
+ * concurrently takes one analyzer per thread.
+ *
+ * Decoding errors are thrown as std::runtime_error.
+ */
+class KeyAnalyzer
+{
+public:
+    /**
+     * @param options      Options controlling how files are decoded
+     * @param profile_sets The tone profile sets keys are estimated with, the
+     *                     default libkeyfinder profiles when empty
+     */
+    explicit KeyAnalyzer(const DecodeOptions &options = DecodeOptions(),
+            std::vector<ToneProfileSet> profile_sets = std::vector<ToneProfileSet>());
+
+    KeyAnalyzer(const KeyAnalyzer&) = delete;
+    KeyAnalyzer& operator=(const KeyAnalyzer&) = delete;
+
+    const DecodeOptions& decode_options() const { return options; }
+    const std::vector<ToneProfileSet>& profile_sets() const { return sets; }
+
+    /**
+     * Compute the collapsed chromagram of an audio file, KeyScoring::BANDS
+     * values which are all zero when the file has no audio.
+     *
+     * Decoding and building the chromagram are overlapped: the file is
+     * decoded on the calling thread while a second thread feeds each decoded
+     * chunk into the progressive chromagram. Only a few chunks are ever held
+     * in memory.
+     *
+     * When the decode options converge, the key is estimated with the first
+     * profile set after each chunk, and decoding stops as soon as it has
+     * converged.
+     *
+     * @param file_path The file to analyze
+     * @param stats     When given, the time spent in each stage of the
+     *                  analysis is added to it
+     */
+    std::vector<double> chromagram(const std::string &file_path, AnalysisStats::FileStats* stats = nullptr);
+
+    /**
+     * Compute the collapsed chromagram of the audio read from a source, such
+     * as a buffer in memory or a network stream, without writing it to disk.
+     *
+     * @param source The source to read encoded audio from
+     * @param stats  When given, the time spent in each stage of the analysis
+     *               is added to it
+     */
+    std::vector<double> chromagram(const AudioSource &source, AnalysisStats::FileStats* stats = nullptr);
+
+    /**
+     * Estimate the key of a chromagram with each of the profile sets.
+     *
+     * @param chromagram The collapsed chromagram
+     * @param keys       The estimated key for each profile set
+     * @param scores     The score of every key for each profile set
+     */
+    void score(const std::vector<double> &chromagram, std::vector<KeyFinder::key_t> &keys,
+            std::vector<KeyScoring::Scores> &scores) const;
+
+    /**
+     * Estimate the key of an audio file with the first profile set.
+     */
+    KeyFinder::key_t key_of_file(const std::string &file_path);
+
+    /**
+     * Describe everything other than the audio file itself that affects the
+     * key estimated with one of the profile sets. This is used to
+     * fingerprint cached results.
+     *
+     * @param set The index of the profile set
+     */
+    std::string parameters(std::size_t set) const;
+
+private:
+    /**
+     * Decodes audio, handing each chunk to the given handler.
+     */
+    typedef std::function<void(const audio_chunk_handler &handle_chunk)> decode_function;
+
+    std::vector<double> build_chromagram(const decode_function &decode, AnalysisStats::FileStats* stats);
+
+    /**
+     * Clear the workspace of the audio of the last file analyzed, keeping
+     * whatever doesn't depend on the audio.
+     */
+    void reset_workspace();
+
+    DecodeOptions options;
+    std::vector<ToneProfileSet> sets;
+    KeyFinder::KeyFinder key_finder;
+    KeyFinder::Workspace workspace;
+
+    // Collects the decoded samples of each chunk, kept from one file to the
+    // next so it only grows to the largest chunk once
+    std::vector<float> samples;
+};
+
+/**
+ * Identify the libkeyfinder build in use by the path, size and modification
+ * time of the shared library it was loaded from.
+ */
+std::string keyfinder_library_id();
+
+#endif
@@ -0,0 +1,148 @@
+#include "key_scoring.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    const std::size_t SEMITONES = 12;
+
+    /**
+     * The dot product of two sets of BANDS values. The vectorized versions
+     * use unaligned loads, as neither the rows nor chromagrams are aligned.
+     */
+    inline double dot(const double* a, const double* b)
+    {
+#if defined(__AVX2__)
+        __m256d sum0 = _mm256_setzero_pd();
+        __m256d sum1 = _mm256_setzero_pd();
+
+        for (std::size_t i = 0; i < KeyScoring::BANDS; i += 8)
+        {
+#if defined(__FMA__)
+            sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i),     _mm256_loadu_pd(b + i),     sum0);
+            sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), sum1);
+#else
+            sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(a + i),     _mm256_loadu_pd(b + i)));
+            sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+#endif
+        }
+
+        const __m256d sum = _mm256_add_pd(sum0, sum1);
+        const __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+
+        return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        float64x2_t sum0 = vdupq_n_f64(0);
+        float64x2_t sum1 = vdupq_n_f64(0);
+
+        for (std::size_t i = 0; i < KeyScoring::BANDS; i += 4)
+        {
+            sum0 = vfmaq_f64(sum0, vld1q_f64(a + i),     vld1q_f64(b + i));
+            sum1 = vfmaq_f64(sum1, vld1q_f64(a + i + 2), vld1q_f64(b + i + 2));
+        }
+
+        return vaddvq_f64(vaddq_f64(sum0, sum1));
+#else
+        double sum = 0;
+
+        for (std::size_t i = 0; i < KeyScoring::BANDS; ++i)
+            sum += a[i] * b[i];
+
+        return sum;
+#endif
+    }
+
+    static_assert(KeyScoring::BANDS % 8 == 0, "The vectorized dot products expect BANDS to be a multiple of 8");
+}
+
+KeyScoring::KeyScorer::KeyScorer(const std::vector<double> &major, const std::vector<double> &minor)
+{
+    if (major.size() != BANDS || minor.size() != BANDS)
+        throw std::invalid_argument("Tone profiles must have a value for every chromagram band");
+
+    for (std::size_t mode = 0; mode < 2; ++mode)
+    {
+        const auto &profile = mode == 0 ? major : minor;
+
+        double norm = 0;
+        for (const auto value : profile)
+            norm += value * value;
+
+        norm = std::sqrt(norm);
+
+        // Keys are ordered by their tonic, in semitones above A (the lowest
+        // chromagram band), alternating between major and minor. A profile
+        // starts at its tonic, so the profile is rotated right by the tonic.
+        for (std::size_t tonic = 0; tonic < SEMITONES; ++tonic)
+        {
+            auto &row = rotations[tonic * 2 + mode];
+
+            for (std::size_t band = 0; band < BANDS; ++band)
+            {
+                const std::size_t octave = band / SEMITONES;
+                const std::size_t semitone = (band % SEMITONES + SEMITONES - tonic) % SEMITONES;
+
+                row[band] = norm > 0 ? profile[octave * SEMITONES + semitone] / norm : 0;
+            }
+        }
+    }
+}
+
+void KeyScoring::KeyScorer::score(const double* chromagram, Scores &scores) const
+{
+    const double norm = std::sqrt(dot(chromagram, chromagram));
+
+    for (std::size_t key = 0; key < KEYS; ++key)
+        scores[key] = norm > 0 ? dot(rotations[key].data(), chromagram) / norm : 0;
+}
+
+KeyFinder::key_t KeyScoring::KeyScorer::key_of(const std::vector<double> &chromagram) const
+{
+    if (chromagram.size() != BANDS)
+        throw std::invalid_argument("Chromagrams must have a value for every band");
+
+    Scores scores;
+    score(chromagram.data(), scores);
+
+    return best_key(scores);
+}
+
+KeyFinder::key_t KeyScoring::KeyScorer::best_key(const Scores &scores)
+{
+    KeyFinder::key_t best = KeyFinder::SILENCE;
+    double best_score = 0;
+
+    for (std::size_t key = 0; key < KEYS; ++key)
+    {
+        if (scores[key] > best_score)
+        {
+            best_score = scores[key];
+            best = (KeyFinder::key_t) key;
+        }
+    }
+
+    return best;
+}
+
+std::vector<KeyFinder::key_t> KeyScoring::KeyScorer::ranked_keys(const Scores &scores)
+{
+    std::vector<KeyFinder::key_t> keys;
+
+    for (std::size_t key = 0; key < KEYS; ++key)
+        keys.push_back((KeyFinder::key_t) key);
+
+    std::stable_sort(keys.begin(), keys.end(), [&scores](KeyFinder::key_t a, KeyFinder::key_t b)
+    {
+        return scores[a] > scores[b];
+    });
+
+    return keys;
+}
@@ -0,0 +1,72 @@
+#ifndef KEY_SCORING_H
+#define KEY_SCORING_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include <keyfinder/constants.h>
+
+namespace KeyScoring
+{
+    // The number of bands in a collapsed chromagram, one for each of the 12
+    // semitones in each of the 6 octaves analyzed by libkeyfinder
+    constexpr std::size_t BANDS = 6 * 12;
+
+    // The number of keys a chromagram is scored against, major and minor for
+    // each semitone, in the order of KeyFinder::key_t
+    constexpr std::size_t KEYS = 24;
+
+    typedef std::array<double, BANDS> Profile;
+    typedef std::array<double, KEYS> Scores;
+
+    /**
+     * Estimates keys from collapsed chromagrams by the cosine similarity of
+     * the chromagram with the major and minor tone profiles rotated to each
+     * key, as libkeyfinder does.
+     *
+     * The rotated profiles are computed and normalized once, up front, into a
+     * single contiguous matrix with one row per key. Scoring a chromagram
+     * is then a dot product with each row, which uses AVX2 or NEON when the
+     * build targets them.
+     */
+    class KeyScorer
+    {
+    public:
+        /**
+         * @param major The octave weighted major profile, BANDS values
+         * @param minor The octave weighted minor profile, BANDS values
+         */
+        KeyScorer(const std::vector<double> &major, const std::vector<double> &minor);
+
+        /**
+         * Compute the similarity of a chromagram with each key. The scores
+         * are all zero for a silent chromagram.
+         *
+         * @param chromagram The collapsed chromagram, BANDS values
+         * @param scores     The similarity with each key, by KeyFinder::key_t
+         */
+        void score(const double* chromagram, Scores &scores) const;
+
+        /**
+         * Estimate the key of a chromagram, the key with the highest score,
+         * or KeyFinder::SILENCE when no key scores above zero.
+         */
+        KeyFinder::key_t key_of(const std::vector<double> &chromagram) const;
+
+        /**
+         * The key with the highest of the given scores.
+         */
+        static KeyFinder::key_t best_key(const Scores &scores);
+
+        /**
+         * All keys ordered from the highest to the lowest score. Keys with
+         * equal scores keep their KeyFinder::key_t order.
+         */
+        static std::vector<KeyFinder::key_t> ranked_keys(const Scores &scores);
+
+    private:
+        std::array<Profile, KEYS> rotations;
+    };
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include "key_server.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The seconds a worker waits for a client to make room for a result before
+// giving up on the client
+const int CLIENT_SEND_TIMEOUT = 10;
+
+/**
+ * Someone sending requests. Results are formatted into a buffer which is
+ * written out to the client in full after each result.
+ */
+class KeyServer::Client
+{
+public:
+    /**
+     * @param fd      The file descriptor results are written to
+     * @param owns_fd Close the file descriptor once the client is done with
+     * @param errors  The stream text format errors are written to, or null
+     *                to write them along with the results
+     */
+    Client(int fd, bool owns_fd, std::ostream* errors,
+            const OutputOptions &options, const std::vector<std::string> &profile_names)
+        : fd(fd), owns_fd(owns_fd), writer(buffer, errors ? *errors : buffer, options, profile_names)
+    {
+        // The TSV header
+        send_buffer();
+    }
+
+    ~Client()
+    {
+        if (owns_fd)
+            close(fd);
+    }
+
+    /**
+     * Note that a request has been queued for the client.
+     */
+    void begin_job()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++pending;
+    }
+
+    /**
+     * Write the result of one of the client's requests.
+     */
+    void write(const AnalysisResult &result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        writer.write(result);
+        send_buffer();
+
+        if (--pending == 0)
+            idle.notify_all();
+    }
+
+    /**
+     * Wait until every queued request has been answered.
+     */
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return pending == 0; });
+    }
+
+private:
+    void send_buffer()
+    {
+        const std::string data = buffer.str();
+        buffer.str("");
+
+        // Once a client has gone away, or stopped reading its results for
+        // longer than the timeout, the rest of its results are dropped
+        for (std::size_t written = 0; ! broken && written < data.size(); )
+        {
+            const ssize_t count = ::write(fd, data.data() + written, data.size() - written);
+
+            if (count < 0 && errno == EINTR)
+                continue;
+
+            if (count <= 0)
+                broken = true;
+            else
+                written += count;
+        }
+    }
+
+    int fd;
+    bool owns_fd;
+    bool broken = false;
+
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::size_t pending = 0;
+
+    std::ostringstream buffer;
+    ResultWriter writer;
+};
+
+KeyServer::KeyServer(unsigned int jobs, std::size_t queue_depth, const DecodeOptions &decode_options,
+        const std::vector<ToneProfileSet> &profile_sets, const OutputOptions &output_options,
+        analyze_function analyze)
+    : output_options(output_options), analyze(std::move(analyze)), jobs(queue_depth)
+{
+    for (const auto &set : profile_sets)
+        profile_names.push_back(set.name);
+
+    // The analyzers are created up front so that no request has to wait for
+    // one to be set up
+    for (unsigned int i = 0; i < jobs; ++i)
+    {
+        auto analyzer = std::make_shared<KeyAnalyzer>(decode_options, profile_sets);
+
+        workers.emplace_back([this, analyzer]()
+        {
+            Job job;
+
+            while (this->jobs.pop(job))
+            {
+                this->analyze(*analyzer, job.result);
+                job.client->write(job.result);
+
+                // Let go of the client, closing its connection when this was
+                // its last request
+                job.client.reset();
+            }
+        });
+    }
+}
+
+KeyServer::~KeyServer()
+{
+    jobs.close();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void KeyServer::serve(std::istream &input, int output_fd, std::ostream &errors)
+{
+    auto client = std::make_shared<Client>(output_fd, false, &errors, output_options, profile_names);
+
+    std::string line;
+    std::size_t index = 0;
+
+    while (std::getline(input, line))
+    {
+        if ( ! line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.empty())
+            continue;
+
+        client->begin_job();
+        jobs.push({client, {index++, line}});
+    }
+
+    client->wait_idle();
+}
+
+void KeyServer::listen(const std::string &socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (socket_path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path is too long " + socket_path);
+
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listener < 0)
+        throw std::runtime_error("Unable to create a socket");
+
+    // Replace the socket left behind by an earlier server, but never any
+    // other kind of file
+    struct stat status;
+    if (lstat(socket_path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+        unlink(socket_path.c_str());
+
+    if (bind(listener, (sockaddr*) &address, sizeof(address)) < 0 || ::listen(listener, SOMAXCONN) < 0)
+    {
+        close(listener);
+        throw std::runtime_error("Unable to listen on " + socket_path);
+    }
+
+    // Clients disconnecting early must not take the server down with them
+    std::signal(SIGPIPE, SIG_IGN);
+
+    while (true)
+    {
+        const int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            close(listener);
+            throw std::runtime_error("Unable to accept connections on " + socket_path);
+        }
+
+        std::thread(&KeyServer::read_requests, this, connection).detach();
+    }
+}
+
+void KeyServer::read_requests(int connection)
+{
+    // Results are written on the worker threads, which must never be held
+    // up for long by a client that doesn't read them
+    timeval timeout = {CLIENT_SEND_TIMEOUT, 0};
+
+    if (setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+    {
+        close(connection);
+        return;
+    }
+
+    auto client = std::make_shared<Client>(connection, true, nullptr, output_options, profile_names);
+
+    std::string pending;
+    std::size_t index = 0;
+    char data[4096];
+
+    auto request = [&](std::string path)
+    {
+        if ( ! path.empty() && path.back() == '\r')
+            path.pop_back();
+
+        if (path.empty())
+            return;
+
+        client->begin_job();
+        jobs.push({client, {index++, std::move(path)}});
+    };
+
+    while (true)
+    {
+        const ssize_t count = read(connection, data, sizeof(data));
+
+        if (count < 0 && errno == EINTR)
+            continue;
+
+        if (count <= 0)
+            break;
+
+        pending.append(data, count);
+
+        std::size_t start = 0, end;
+        while ((end = pending.find('\n', start)) != std::string::npos)
+        {
+            request(pending.substr(start, end - start));
+            start = end + 1;
+        }
+
+        pending.erase(0, start);
+    }
+
+    // A last request without a newline
+    request(pending);
+}
@@ -0,0 +1,91 @@
+#ifndef KEY_SERVER_H
+#define KEY_SERVER_H
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blocking_queue.h"
+#include "key_analyzer.h"
+#include "result_writer.h"
+
+/**
+ * Answers requests to analyze files from a pool of worker threads which are
+ * started once and kept warm, each with its own KeyAnalyzer. Requests are
+ * newline separated paths, and the result of each is written back in the
+ * output format as soon as it completes, so results may arrive out of order.
+ *
+ * Requests wait in a queue of a fixed depth. Once it is full no more requests
+ * are read until a worker frees up, pushing back on whoever is sending them.
+ * A socket client which stops reading its results for several seconds while
+ * a worker waits to write one is dropped, so that it can't stall the workers.
+ */
+class KeyServer
+{
+public:
+    /**
+     * Analyzes the file of a result with the given analyzer, filling in the
+     * rest of the result.
+     */
+    typedef std::function<void(KeyAnalyzer &analyzer, AnalysisResult &result)> analyze_function;
+
+    /**
+     * @param jobs           The number of worker threads
+     * @param queue_depth    The number of requests allowed to wait for a worker
+     * @param decode_options Options controlling how files are decoded
+     * @param profile_sets   The tone profile sets keys are estimated with
+     * @param output_options How results are written
+     * @param analyze        Called on a worker thread to analyze each file
+     */
+    KeyServer(unsigned int jobs, std::size_t queue_depth, const DecodeOptions &decode_options,
+            const std::vector<ToneProfileSet> &profile_sets, const OutputOptions &output_options,
+            analyze_function analyze);
+    ~KeyServer();
+
+    KeyServer(const KeyServer&) = delete;
+    KeyServer& operator=(const KeyServer&) = delete;
+
+    /**
+     * Answer the requests read from a stream until it ends, returning once
+     * every request has been answered.
+     *
+     * @param input     The stream to read requests from
+     * @param output_fd The file descriptor results are written to
+     * @param errors    The stream text format errors are written to
+     */
+    void serve(std::istream &input, int output_fd, std::ostream &errors);
+
+    /**
+     * Listen on a Unix domain socket, answering the requests of each client
+     * which connects on the same connection. A client may shut down its end
+     * of the connection once it has sent its requests, the connection is
+     * closed once all of them have been answered. This never returns.
+     *
+     * @param socket_path The path of the socket, any socket already at the
+     *                    path is replaced
+     */
+    void listen(const std::string &socket_path);
+
+private:
+    class Client;
+
+    struct Job
+    {
+        std::shared_ptr<Client> client;
+        AnalysisResult result;
+    };
+
+    void read_requests(int connection);
+
+    OutputOptions output_options;
+    std::vector<std::string> profile_names;
+    analyze_function analyze;
+
+    BlockingQueue<Job> jobs;
+    std::vector<std::thread> workers;
+};
+
+#endif
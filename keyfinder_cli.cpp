@@ -1,366 +1,470 @@
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <map>
 #include <mutex>
+#include <numeric>
+#include <thread>
 #include <memory>
+#include <dirent.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
 #include <sstream>
 #include <vector>
-#include <iterator>
 #include <keyfinder/keyfinder.h>
 #include <keyfinder/constants.h>
 
 extern "C"
 {
 #include <libavutil/avutil.h>
-#include <libavutil/opt.h>
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavresample/avresample.h>
 }
 
 #include "key_notations.h"
-
-const int BAD_PACKET_THRESHOLD = 100;
+#include "analysis_stats.h"
+#include "blocking_queue.h"
+#include "chroma_store.h"
+#include "key_analyzer.h"
+#include "key_server.h"
+#include "manifest.h"
+#include "result_cache.h"
+#include "result_writer.h"
 
 /**
- * The "safe" AVPacket wrapper will handle memory management of the packet,
- * ensuring that if an instance of this packet wrapper is destroyed the
- * containing packet is freed from memory.
+ * Read a newline separated list of file paths. Empty lines are ignored.
+ *
+ * @param stream The stream to read the paths from
+ * @param paths  The list to append the paths to
  */
-struct SafeAVPacket
+void read_file_list(std::istream &stream, std::vector<std::string> &paths)
 {
-    AVPacket inner_packet;
+    std::string line;
 
-    SafeAVPacket()
+    while (std::getline(stream, line))
     {
-        av_init_packet(&inner_packet);
+        if ( ! line.empty() && line.back() == '\r')
+            line.pop_back();
 
-        inner_packet.data = nullptr;
-        inner_packet.size = 0;
+        if ( ! line.empty())
+            paths.push_back(line);
     }
+}
+
+// The most jobs, decode threads and queued requests which may be asked for.
+// Far more than any machine has cores for, but small enough that a mistyped
+// value can't try to start billions of threads.
+const unsigned long MAX_JOBS = 1024;
+const unsigned long MAX_DECODE_THREADS = 256;
+const unsigned long MAX_QUEUE_DEPTH = 1 << 20;
+
+// The most segments a file may be analyzed in, each of them some seconds
+const unsigned long MAX_SEGMENTS = 1000;
+
+// The most chunks a key may be asked to converge for, hours of audio
+const unsigned long MAX_CONVERGE_CHUNKS = 10000;
+
+/**
+ * Parse a count given as an option. std::stoull happily wraps negative
+ * numbers around to huge ones, so any sign is rejected.
+ *
+ * @param text  The text of the option
+ * @param max   The largest count allowed
+ * @param count Set to the count
+ * @return false if the text isn't a count up to max
+ */
+bool parse_count(const std::string &text, unsigned long long max, unsigned long long &count)
+{
+    if (text.find_first_of("+-") != std::string::npos)
+        return false;
 
-    ~SafeAVPacket()
+    try
     {
-        if (inner_packet.data)
-        {
-            av_packet_unref(&inner_packet);
-        }
+        count = std::stoull(text);
     }
+    catch (std::exception &e)
+    {
+        return false;
+    }
+
+    return count <= max;
+}
+
+/**
+ * The file extensions recognized as audio when walking a directory, unless
+ * others are given with --extensions.
+ */
+const char* const DEFAULT_EXTENSIONS = "aac,aif,aiff,ape,flac,m4a,mka,mp3,mp4,ogg,opus,wav,wma,wv";
 
-    /**
-     * Read into this packet from the format_context. A stream index should
-     * also be provided so that the packet knows what stream to read from.
-     *
-     * @param format_context The format context to read data from
-     * @param stream_index   The index of the stream we want data from
-     */
-    void read(AVFormatContext* format_context, int stream_index)
+/**
+ * Split a comma separated list of file extensions, lowercased and without
+ * any leading dot.
+ */
+std::vector<std::string> parse_extensions(const std::string &list)
+{
+    std::vector<std::string> extensions;
+    std::istringstream fields(list);
+    std::string extension;
+
+    while (std::getline(fields, extension, ','))
     {
-        while (true)
-        {
-            if (inner_packet.data)
-            {
-                av_packet_unref(&inner_packet);
-            }
+        if ( ! extension.empty() && extension.front() == '.')
+            extension.erase(0, 1);
 
-            if (av_read_frame(format_context, &inner_packet) < 0)
-            {
-                inner_packet.data = nullptr;
-            }
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-            // Stop reading once we've read a packet from this stream
-            if (inner_packet.stream_index == stream_index)
-                break;
-        }
+        if ( ! extension.empty())
+            extensions.push_back(extension);
     }
-};
+
+    return extensions;
+}
 
 /**
- * Fill an instance of KeyFinder::AudioData with the audio data from a file.
- * This does the ffmpeg dance to decode any type of audio stream into PCM_16
- * samples.
- *
- * @param file_path The file to read audio data from
- * @param audio     The KeyFinder AudioData container to fill
+ * Whether the name of a file ends in one of the extensions, ignoring case.
  */
-void fill_audio_data(const char* file_path, KeyFinder::AudioData &audio)
+bool has_extension(const std::string &name, const std::vector<std::string> &extensions)
 {
-    // Initialize AV format/codec things once
-    static std::once_flag init_flag;
-    std::call_once(init_flag, []() { av_register_all(); });
+    const auto dot = name.rfind('.');
 
-    AVFormatContext* format_ctx_ptr = avformat_alloc_context();
+    if (dot == std::string::npos)
+        return false;
 
-    // Open the file for decoding
-    if (avformat_open_input(&format_ctx_ptr, file_path, nullptr, nullptr) < 0)
-        throw std::runtime_error("Unable to open audio file (File doesn't eixst or unhandle format)");
+    std::string extension = name.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-    // Manage the format context. Instead of initalizing this before opening
-    // the input we handle it after since avformat_open_input will free the
-    // context for us upon error.
-    std::shared_ptr<AVFormatContext> format_context(format_ctx_ptr, &avformat_free_context);
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
 
-    // Determine stream information
-    if (avformat_find_stream_info(format_ctx_ptr, nullptr) < 0)
-        throw std::runtime_error("Unable to get stream info");
+/**
+ * Find the audio files in a directory and all of its subdirectories, in
+ * sorted order so that every walk of an unchanged library lists the same
+ * files in the same order. Symbolic links to files are followed, but links
+ * to directories are not, so a link back up the tree can't loop forever.
+ * Subdirectories which can't be read are skipped.
+ *
+ * @param directory  The directory to walk
+ * @param extensions The extensions of audio files
+ * @param paths      The list to append the paths of the files to
+ * @return false if the directory itself could not be read
+ */
+bool find_audio_files(const std::string &directory, const std::vector<std::string> &extensions,
+        std::vector<std::string> &paths)
+{
+    DIR* dir = opendir(directory.c_str());
 
-    const AVStream* audio_stream = nullptr;
+    if ( ! dir)
+        return false;
 
-    // Get the audio stream from the context. We have to look through all of
-    // the streams, we pick the first one that is recognized as an audio stream
-    for (unsigned int i = 0; i < format_context->nb_streams; ++i)
+    std::vector<std::string> names;
+    while (const dirent* entry = readdir(dir))
     {
-        auto stream = format_context->streams[i];
+        const std::string name = entry->d_name;
 
-        if (stream->codec->codec_type == AVMEDIA_TYPE_AUDIO)
-        {
-            audio_stream = stream;
-            break;
-        }
+        if (name != "." && name != "..")
+            names.push_back(name);
     }
 
-    if (audio_stream == nullptr)
-        throw std::runtime_error("File does not have any audio streams");
-
-    // Get the codec context and codec handler
-    const auto codec_context = audio_stream->codec;
-    const auto codec = avcodec_find_decoder(codec_context->codec_id);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
 
-    if (codec == nullptr)
-        throw std::runtime_error("Unsupported audio stream");
+    const std::string prefix = ( ! directory.empty() && directory.back() == '/') ? directory : directory + "/";
 
-    // Open the codec
-    if (avcodec_open2(codec_context, codec, nullptr) < 0)
-        throw std::runtime_error("Unable to open the codec");
+    for (const auto &name : names)
+    {
+        const std::string path = prefix + name;
+        struct stat status;
 
-    // Setup the audio resample context in situations where we need to resample
-    // the audio stream samples into 16bit PCM data
-    std::shared_ptr<AVAudioResampleContext> resample_context(
-            avresample_alloc_context(),
-            [](AVAudioResampleContext* c) { avresample_free(&c); });
-    auto resample_ctx_ptr = resample_context.get();
+        if (lstat(path.c_str(), &status) < 0)
+            continue;
 
-    // The channel_layout may need to be populated from the number of channels.
-    // This is usually the case with formats using the pcm_16* codecs where
-    // it's not nessicarily possible to determine the channel layout. In these
-    // situations we can use the default channel_layout
-    if ( ! codec_context->channel_layout)
-    {
-        codec_context->channel_layout = av_get_default_channel_layout(codec_context->channels);
+        if (S_ISDIR(status.st_mode))
+            find_audio_files(path, extensions, paths);
+        else if (has_extension(name, extensions)
+                && (S_ISREG(status.st_mode) || (S_ISLNK(status.st_mode)
+                    && stat(path.c_str(), &status) == 0 && S_ISREG(status.st_mode))))
+            paths.push_back(path);
     }
 
-    av_opt_set_int(resample_ctx_ptr, "in_sample_fmt",      codec_context->sample_fmt,     0);
-    av_opt_set_int(resample_ctx_ptr, "in_sample_rate",     codec_context->sample_rate,    0);
-    av_opt_set_int(resample_ctx_ptr, "in_channel_layout",  codec_context->channel_layout, 0);
-    av_opt_set_int(resample_ctx_ptr, "out_sample_fmt",     AV_SAMPLE_FMT_S16,             0);
-    av_opt_set_int(resample_ctx_ptr, "out_sample_rate",    codec_context->sample_rate,    0);
-    av_opt_set_int(resample_ctx_ptr, "out_channel_layout", codec_context->channel_layout, 0);
+    return true;
+}
 
-    if (avresample_open(resample_ctx_ptr) < 0)
-        throw std::runtime_error("Unable to open the resample context");
+/**
+ * Whether a file belongs to one of the shards a batch is split into. Files
+ * are assigned by a hash of their path which is the same on every machine,
+ * unlike std::hash, so each of many nodes given the same list of files
+ * analyzes a disjoint share of it without any coordination.
+ *
+ * @param path  The path of the file, as it was given
+ * @param shard The index of the shard, from 0
+ * @param count The number of shards
+ */
+bool in_shard(const std::string &path, unsigned long shard, unsigned long count)
+{
+    return std::stoull(ResultCache::fingerprint(path), nullptr, 16) % count == shard;
+}
 
-    // Prepare the KeyFinder::AudioData object
-    audio.setFrameRate((unsigned int) codec_context->sample_rate);
-    audio.setChannels(codec_context->channels);
+/**
+ * The orders the files of a batch can be analyzed in.
+ */
+enum class Schedule
+{
+    // The order the files were given in
+    INPUT,
 
-    SafeAVPacket packet;
-    std::shared_ptr<AVFrame> audio_frame(av_frame_alloc(), &av_free);
+    // The largest files first
+    SIZE,
 
-    int current_packet_offset = 0;
-    int back_packet_count = 0;
+    // The longest audio first, by the duration given by each container
+    DURATION,
+};
 
-    // Read all stream samples into the AudioData container
-    while (true)
-    {
-        // Read another packet once we've consumed all of the previous one
-        if (current_packet_offset >= packet.inner_packet.size)
-        {
-            packet.read(format_ctx_ptr, audio_stream->index);
+/**
+ * Order the files of a batch by how much work analyzing each of them takes,
+ * the most first, so that a long file is never left to finish on its own
+ * after every other worker has run out of files. The work of each file is
+ * estimated on the given number of threads.
+ *
+ * @param paths    The files of the batch
+ * @param schedule How the files are ordered
+ * @param jobs     The number of threads estimating the work
+ * @return The indexes of the files in the order they should be analyzed
+ */
+std::vector<std::size_t> schedule_files(const std::vector<std::string> &paths,
+        Schedule schedule, unsigned int jobs)
+{
+    std::vector<std::size_t> order(paths.size());
+    std::iota(order.begin(), order.end(), 0);
 
-            current_packet_offset = 0;
+    if (schedule == Schedule::INPUT)
+        return order;
 
-            // We're all done once we have no more packets to read
-            if (packet.inner_packet.size <= 0)
-                break;
-        }
+    // Files which can't be opened have no work, and are left until the end
+    std::vector<double> work(paths.size(), 0);
+    std::atomic<std::size_t> next_index(0);
 
-        int frame_available = 0;
-        const auto processed_size = avcodec_decode_audio4(codec_context,
-                audio_frame.get(), &frame_available, &packet.inner_packet);
+    auto estimate = [&]()
+    {
+        ResultCache::FileStamp stamp;
+        std::size_t index;
 
-        // Bad packet. Maybe we can ignore it
-        if (processed_size < 0)
+        while ((index = next_index++) < paths.size())
         {
-            if (++back_packet_count > BAD_PACKET_THRESHOLD)
-                throw std::runtime_error("Too many bad packets");
-
-            current_packet_offset    = 0;
-            packet.inner_packet.size = 0;
-
-            continue;
+            if (schedule == Schedule::DURATION)
+                work[index] = probe_duration(paths[index].c_str());
+            else if (ResultCache::stamp(paths[index], stamp))
+                work[index] = stamp.size;
         }
+    };
 
-        current_packet_offset += processed_size;
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < jobs; ++i)
+        threads.emplace_back(estimate);
 
-        // Seek The packet forward for the ammount of data we've read. If there
-        // is still data left in the packet that wasn't decoded we will handle
-        // that next interation of this loop
-        packet.inner_packet.size -= current_packet_offset;
-        packet.inner_packet.data += current_packet_offset;
+    for (auto &thread : threads)
+        thread.join();
 
-        // Not enough data to read the frame. Keep going
-        if ( ! frame_available)
-            continue;
+    std::stable_sort(order.begin(), order.end(),
+            [&work](std::size_t a, std::size_t b) { return work[a] > work[b]; });
 
-        // The KeyFinder::AudioData object expects non-planar 16 bit PCM data.
-        // If we didn't decode audio data in that format we have to re-sample
-        if (codec_context->sample_fmt != AV_SAMPLE_FMT_S16)
-        {
-            std::shared_ptr<AVFrame> converted_frame(av_frame_alloc(), &av_free);
+    return order;
+}
 
-            converted_frame->channel_layout = audio_frame->channel_layout;
-            converted_frame->sample_rate = audio_frame->sample_rate;
-            converted_frame->format = AV_SAMPLE_FMT_S16;
+/**
+ * Pin the calling thread to its share of the cores it may run on, so that it
+ * and the memory it touches first stay on the same core and NUMA node. With
+ * at least as many cores as workers each worker gets a block of neighbouring
+ * cores, which share the caches and node, otherwise the workers take turns.
+ * Threads started by the worker inherit its cores.
+ *
+ * @param worker The index of the worker
+ * @param jobs   The number of workers
+ * @return false when the thread could not be pinned
+ */
+bool pin_worker(unsigned int worker, unsigned int jobs)
+{
+    cpu_set_t available;
 
-            if (avresample_convert_frame(resample_ctx_ptr, converted_frame.get(), audio_frame.get()) < 0)
-                throw std::runtime_error("Unable to resample audio into 16bit PCM data");
+    if (sched_getaffinity(0, sizeof(available), &available) < 0)
+        return false;
 
-            audio_frame.swap(converted_frame);
-        }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &available))
+            cpus.push_back(cpu);
+    }
 
-        // Since we we're dealing with 16bit samples we need to convert our
-        // data pointer to a int16_t (from int8_t). This also means that we
-        // need to halve our sample count since the sample count expected one
-        // byte per sample, instead of two.
-        int16_t* sample_data = (int16_t*) audio_frame->extended_data[0];
-        unsigned int sample_count = audio_frame->linesize[0] / 2;
+    if (cpus.empty())
+        return false;
 
-        // Populate the KeyFinder::AudioData object with the samples
-        int old_sample_count = audio.getSampleCount();
-        audio.addToSampleCount(sample_count);
-        audio.resetIterators();
-        audio.advanceWriteIterator(old_sample_count);
-
-        for (unsigned int i = 0; i < sample_count; ++i)
-        {
-            audio.setSampleAtWriteIterator((float) sample_data[i]);
-            audio.advanceWriteIterator();
-        }
-    }
-}
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
 
+    for (std::size_t i = 0; i < cpus.size(); ++i)
+    {
+        const bool ours = cpus.size() >= jobs
+            ? i * jobs / cpus.size() == worker
+            : i == worker % cpus.size();
 
-  static double MAJOR_PROFILE[SEMITONES] = {
-    7.23900502618145225142,
-    3.50351166725158691406,
-    3.58445177536649417505,
-    2.84511816478676315967,
-    5.81898892118549859731,
-    4.55865057415321039969,
-    2.44778850545506543313,
-    6.99473192146829525484,
-    3.39106613673504853068,
-    4.55614256655143456953,
-    4.07392666663523606019,
-    4.45932757378886890365,
-
-  };
-
-  static double MINOR_PROFILE[SEMITONES] = {
-    7.00255045060284420089,
-    3.14360279015996679775,
-    4.35904319714962529275,
-    5.40418120718934069657,
-    3.67234420879306133756,
-    4.08971184917797891956,
-    3.90791435991553992579,
-    6.19960288562316463867,
-    3.63424625625277419871,
-    2.87241191079875557435,
-    5.35467999794542670600,
-    3.83242038595048351013,
-  };
-  // This is magic, magic, MAAAAAAAAGIC! 
-  static double OCTAVE_WEIGHTS[OCTAVES] = {
-    0.39997267549999998559,
-    0.55634425248300645173,
-    0.52496636345143543600,
-    0.60847548384277727607,
-    0.59898115679999996974,
-    0.49072435317960994006,
-  };
-
-  static std::vector<double> tpMajor;
-  static std::vector<double> tpMinor;
-
-  const std::vector<double>& toneProfileMajor(double profiles[SEMITONES]) {
-    if (tpMajor.size() == 0) {
-      for (unsigned int o = 0; o < OCTAVES; o++) {
-        for (unsigned int s = 0; s < SEMITONES; s++) {
-          tpMajor.push_back(OCTAVE_WEIGHTS[o] * profiles[s]);
-        }
-      }
+        if (ours)
+            CPU_SET(cpus[i], &pinned);
     }
-    return tpMajor;
-  }
 
-  const std::vector<double>& toneProfileMinor(double profiles[SEMITONES]) {
-    if (tpMinor.size() == 0) {
-      for (unsigned int o = 0; o < OCTAVES; o++) {
-        for (unsigned int s = 0; s < SEMITONES; s++) {
-          tpMinor.push_back(OCTAVE_WEIGHTS[o] * profiles[s]);
-        }
-      }
-    }
-    return tpMinor;
-  }
-
-template<typename Out>
-void split(const std::string &s, char delim, Out result) {
-    std::stringstream ss;
-    ss.str(s);
-    std::string item;
-    while (std::getline(ss, item, delim)) {
-        *(result++) = item;
-    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) == 0;
 }
 
-
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::vector<std::string> elems;
-    split(s, delim, std::back_inserter(elems));
-    return elems;
-}
+// Options which only have a long form
+enum LongOption
+{
+    OPTION_START = 256,
+    OPTION_DURATION,
+    OPTION_SEGMENTS,
+    OPTION_CACHE,
+    OPTION_SAVE_CHROMA,
+    OPTION_RESCORE,
+    OPTION_PROFILES,
+    OPTION_CONFIDENCE,
+    OPTION_TOP,
+    OPTION_FORMAT,
+    OPTION_STATS,
+    OPTION_SERVE,
+    OPTION_LISTEN,
+    OPTION_QUEUE_DEPTH,
+    OPTION_MMAP,
+    OPTION_IO_BUFFER_SIZE,
+    OPTION_PREFETCH,
+    OPTION_DECODE_THREADS,
+    OPTION_FAST_PROBE,
+    OPTION_CONVERGE,
+    OPTION_CONVERGE_MARGIN,
+    OPTION_SILENCE_THRESHOLD,
+    OPTION_SCHEDULE,
+    OPTION_PIN,
+    OPTION_RECURSIVE,
+    OPTION_EXTENSIONS,
+    OPTION_MANIFEST,
+    OPTION_SHARD,
+    OPTION_MERGE_CACHE,
+    OPTION_MAX_SECONDS,
+    OPTION_MAX_DURATION,
+    OPTION_MAX_SAMPLES,
+};
 
 int main(int argc, char** argv)
 {
     auto display_usage = [argv](std::ostream &stream)
     {
-        stream << "Usage: " << argv[0] << " [-h] [-n key-notation] [-mj major-profile] [-mi minor-profile] filename"
+        stream << "Usage: " << argv[0] << " [-h] [-n key-notation] [-mj major-profile] [-mi minor-profile]"
+               << " [-f file-list] [-J jobs] [-u] [-d] [--start seconds] [--duration seconds]"
+               << " [--segments count] [--cache cache-file] [--save-chroma chroma-store]"
+               << " [--rescore chroma-store] [--profiles profile-sets] [--confidence] [--top count]"
+               << " [--format text|jsonl|tsv] [--stats] [--serve] [--listen socket]"
+               << " [--queue-depth count] [--mmap] [--io-buffer-size bytes] [--prefetch]"
+               << " [--decode-threads count] [--fast-probe]"
+               << " [--converge chunks] [--converge-margin margin] [--silence-threshold dbfs]"
+               << " [--schedule input|size|duration] [--pin]"
+               << " [--recursive directory] [--extensions list] [--manifest manifest-file]"
+               << " [--shard index/count] [--merge-cache cache-file]"
+               << " [--max-seconds seconds] [--max-duration seconds] [--max-samples count]"
+               << " [filename...]"
                << std::endl;
     };
 
     // Default to the standard key notation
-    auto selected_notation = KeyNotation::standard;
+    OutputOptions output_options;
 
 
     struct option options[] =
     {
-        {"notation", required_argument, 0, 'n'},
-        {"major",    required_argument, 0, 'j'},
-        {"minor",    required_argument, 0, 'i'},
-        {"help",     no_argument,       0, 'h'},
+        {"notation",   required_argument, 0, 'n'},
+        {"major",      required_argument, 0, 'j'},
+        {"minor",      required_argument, 0, 'i'},
+        {"files-from", required_argument, 0, 'f'},
+        {"jobs",       required_argument, 0, 'J'},
+        {"unordered",  no_argument,       0, 'u'},
+        {"downmix",    no_argument,       0, 'd'},
+        {"start",      required_argument, 0, OPTION_START},
+        {"duration",   required_argument, 0, OPTION_DURATION},
+        {"segments",   required_argument, 0, OPTION_SEGMENTS},
+        {"cache",       required_argument, 0, OPTION_CACHE},
+        {"save-chroma", required_argument, 0, OPTION_SAVE_CHROMA},
+        {"rescore",     required_argument, 0, OPTION_RESCORE},
+        {"profiles",    required_argument, 0, OPTION_PROFILES},
+        {"confidence",  no_argument,       0, OPTION_CONFIDENCE},
+        {"top",         required_argument, 0, OPTION_TOP},
+        {"format",      required_argument, 0, OPTION_FORMAT},
+        {"stats",       no_argument,       0, OPTION_STATS},
+        {"serve",       no_argument,       0, OPTION_SERVE},
+        {"listen",      required_argument, 0, OPTION_LISTEN},
+        {"queue-depth", required_argument, 0, OPTION_QUEUE_DEPTH},
+        {"mmap",        no_argument,       0, OPTION_MMAP},
+        {"io-buffer-size", required_argument, 0, OPTION_IO_BUFFER_SIZE},
+        {"prefetch",    no_argument,       0, OPTION_PREFETCH},
+        {"decode-threads", required_argument, 0, OPTION_DECODE_THREADS},
+        {"fast-probe",  no_argument,       0, OPTION_FAST_PROBE},
+        {"converge",    required_argument, 0, OPTION_CONVERGE},
+        {"converge-margin", required_argument, 0, OPTION_CONVERGE_MARGIN},
+        {"silence-threshold", required_argument, 0, OPTION_SILENCE_THRESHOLD},
+        {"schedule",    required_argument, 0, OPTION_SCHEDULE},
+        {"pin",         no_argument,       0, OPTION_PIN},
+        {"recursive",   required_argument, 0, OPTION_RECURSIVE},
+        {"extensions",  required_argument, 0, OPTION_EXTENSIONS},
+        {"manifest",    required_argument, 0, OPTION_MANIFEST},
+        {"shard",       required_argument, 0, OPTION_SHARD},
+        {"merge-cache", required_argument, 0, OPTION_MERGE_CACHE},
+        {"max-seconds", required_argument, 0, OPTION_MAX_SECONDS},
+        {"max-duration", required_argument, 0, OPTION_MAX_DURATION},
+        {"max-samples", required_argument, 0, OPTION_MAX_SAMPLES},
+        {"help",       no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
-    std::vector<std::string> profile_str = {};
-    double profiles[SEMITONES] = {};
-            
+    double major_profile[SEMITONES], minor_profile[SEMITONES];
+    std::copy(MAJOR_PROFILE, MAJOR_PROFILE + SEMITONES, major_profile);
+    std::copy(MINOR_PROFILE, MINOR_PROFILE + SEMITONES, minor_profile);
+
+    std::vector<ToneProfileSet> profile_sets;
+
+    std::vector<std::string> file_paths;
+    bool batch_mode = false;
+    bool list_from_stdin = false;
+
+    unsigned int jobs = 1;
+    bool unordered = false;
+
+    DecodeOptions decode_options;
+    std::string cache_path;
+    std::string chroma_path;
+    std::string rescore_path;
+    bool show_stats = false;
+
+    bool serve = false;
+    std::string listen_path;
+    std::size_t queue_depth = 0;
+    bool prefetch = false;
+    Schedule schedule = Schedule::INPUT;
+    bool pin = false;
+    std::vector<std::string> recursive_paths;
+    std::string extension_list = DEFAULT_EXTENSIONS;
+    std::string manifest_path;
+    unsigned long shard_index = 0, shard_count = 0;
+    std::vector<std::string> merge_paths;
 
     opterr = 0;
 
-    char c;
-    while ((c = getopt_long(argc, argv, "n:j:i:h", options, nullptr)) != -1)
+    int c;
+    while ((c = getopt_long(argc, argv, "n:j:i:f:J:udh", options, nullptr)) != -1)
     {
         switch (c)
         {
@@ -379,64 +483,787 @@ int main(int argc, char** argv)
                 return 1;
             }
 
-            selected_notation = KeyNotation::mappings[optarg];
+            output_options.notation = KeyNotation::mappings[optarg];
             break;
         case 'j':
-           profile_str = split(optarg,',');
-           for (unsigned int s = 0; s < SEMITONES; s++) {
-                profiles[s] =stod(profile_str[s]);
+        case 'i':
+            if ( ! parse_profile(optarg, c == 'j' ? major_profile : minor_profile))
+            {
+                std::cerr << "Invalid tone profile, expected " << SEMITONES
+                          << " comma separated numbers" << std::endl;
+                return 1;
             }
-            toneProfileMajor(profiles);
             break;
-        case 'i':
-            profile_str = split(optarg,',');
-            for (unsigned int s = 0; s < SEMITONES; s++) {
-                profiles[s] =stod(profile_str[s]);
+        case OPTION_PROFILES:
+        {
+            std::ifstream profiles_file(optarg);
+
+            if ( ! profiles_file)
+            {
+                std::cerr << "Unable to open tone profiles " << optarg << std::endl;
+                return 1;
+            }
+
+            try
+            {
+                read_profile_sets(profiles_file, profile_sets);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << optarg << ": " << e.what() << std::endl;
+                return 1;
+            }
+            break;
+        }
+        case 'f':
+        {
+            batch_mode = true;
+
+            if (std::string(optarg) == "-")
+            {
+                list_from_stdin = true;
+                read_file_list(std::cin, file_paths);
+                break;
+            }
+
+            std::ifstream list_file(optarg);
+
+            if ( ! list_file)
+            {
+                std::cerr << "Unable to open file list " << optarg << std::endl;
+                return 1;
+            }
+
+            read_file_list(list_file, file_paths);
+            break;
+        }
+        case 'J':
+        {
+            unsigned long long count;
+
+            if ( ! parse_count(optarg, MAX_JOBS, count))
+            {
+                std::cerr << "Invalid number of jobs, at most " << MAX_JOBS << " are allowed" << std::endl;
+                return 1;
+            }
+
+            jobs = count;
+            break;
+        }
+        case 'u':
+            unordered = true;
+            break;
+        case 'd':
+            decode_options.downmix = true;
+            break;
+        case OPTION_START:
+        case OPTION_DURATION:
+        {
+            double seconds = -1;
+
+            try
+            {
+                seconds = std::stod(optarg);
+            }
+            catch (std::exception &e) {}
+
+            if (seconds < 0)
+            {
+                std::cerr << "Invalid number of seconds" << std::endl;
+                return 1;
+            }
+
+            (c == OPTION_START ? decode_options.start : decode_options.duration) = seconds;
+            break;
+        }
+        case OPTION_SEGMENTS:
+        {
+            unsigned long long count;
+
+            if ( ! parse_count(optarg, MAX_SEGMENTS, count))
+            {
+                std::cerr << "Invalid number of segments, at most " << MAX_SEGMENTS << " are allowed" << std::endl;
+                return 1;
+            }
+
+            decode_options.segments = count;
+            break;
+        }
+        case OPTION_CACHE:
+            cache_path = optarg;
+            break;
+        case OPTION_SAVE_CHROMA:
+            chroma_path = optarg;
+            break;
+        case OPTION_RESCORE:
+            rescore_path = optarg;
+            break;
+        case OPTION_FORMAT:
+        {
+            const std::string format = optarg;
+
+            if (format == "text")
+                output_options.format = OutputFormat::TEXT;
+            else if (format == "jsonl")
+                output_options.format = OutputFormat::JSONL;
+            else if (format == "tsv")
+                output_options.format = OutputFormat::TSV;
+            else
+            {
+                std::cerr << "Invalid output format" << std::endl;
+                return 1;
+            }
+            break;
+        }
+        case OPTION_CONFIDENCE:
+            output_options.show_confidence = true;
+            break;
+        case OPTION_STATS:
+            show_stats = true;
+            break;
+        case OPTION_SERVE:
+            serve = true;
+            break;
+        case OPTION_LISTEN:
+            listen_path = optarg;
+            break;
+        case OPTION_QUEUE_DEPTH:
+        {
+            unsigned long long depth;
+
+            if ( ! parse_count(optarg, MAX_QUEUE_DEPTH, depth) || depth == 0)
+            {
+                std::cerr << "Invalid queue depth" << std::endl;
+                return 1;
+            }
+
+            queue_depth = depth;
+            break;
+        }
+        case OPTION_MMAP:
+            decode_options.map_files = true;
+            break;
+        case OPTION_IO_BUFFER_SIZE:
+            try
+            {
+                decode_options.io_buffer_size = std::stoul(optarg);
+            }
+            catch (std::exception &e)
+            {
+                decode_options.io_buffer_size = 0;
+            }
+
+            // The buffer size is handed to FFmpeg as an int
+            if (decode_options.io_buffer_size == 0 || decode_options.io_buffer_size > (1u << 30))
+            {
+                std::cerr << "Invalid IO buffer size" << std::endl;
+                return 1;
+            }
+            break;
+        case OPTION_PREFETCH:
+            prefetch = true;
+            break;
+        case OPTION_DECODE_THREADS:
+        {
+            unsigned long long count;
+
+            if ( ! parse_count(optarg, MAX_DECODE_THREADS, count))
+            {
+                std::cerr << "Invalid number of decode threads, at most " << MAX_DECODE_THREADS
+                          << " are allowed" << std::endl;
+                return 1;
+            }
+
+            decode_options.decode_threads = count;
+            break;
+        }
+        case OPTION_FAST_PROBE:
+            decode_options.fast_probe = true;
+            break;
+        case OPTION_CONVERGE:
+        {
+            unsigned long long count;
+
+            if ( ! parse_count(optarg, MAX_CONVERGE_CHUNKS, count) || count == 0)
+            {
+                std::cerr << "Invalid number of chunks to converge for, at most "
+                          << MAX_CONVERGE_CHUNKS << " are allowed" << std::endl;
+                return 1;
+            }
+
+            decode_options.converge_chunks = count;
+            break;
+        }
+        case OPTION_CONVERGE_MARGIN:
+        {
+            double margin = -1;
+
+            try
+            {
+                margin = std::stod(optarg);
+            }
+            catch (std::exception &e) {}
+
+            if (margin < 0)
+            {
+                std::cerr << "Invalid convergence margin" << std::endl;
+                return 1;
+            }
+
+            decode_options.converge_margin = margin;
+            break;
+        }
+        case OPTION_SILENCE_THRESHOLD:
+        {
+            double threshold = 0;
+
+            try
+            {
+                threshold = std::stod(optarg);
+            }
+            catch (std::exception &e) {}
+
+            if ( ! (threshold < 0))
+            {
+                std::cerr << "Invalid silence threshold, it must be below 0 dBFS" << std::endl;
+                return 1;
+            }
+
+            decode_options.silence_threshold = threshold;
+            break;
+        }
+        case OPTION_SCHEDULE:
+        {
+            const std::string name = optarg;
+
+            if (name == "input")
+                schedule = Schedule::INPUT;
+            else if (name == "size")
+                schedule = Schedule::SIZE;
+            else if (name == "duration")
+                schedule = Schedule::DURATION;
+            else
+            {
+                std::cerr << "Invalid schedule" << std::endl;
+                return 1;
+            }
+            break;
+        }
+        case OPTION_PIN:
+            pin = true;
+            break;
+        case OPTION_RECURSIVE:
+            batch_mode = true;
+            recursive_paths.push_back(optarg);
+            break;
+        case OPTION_EXTENSIONS:
+            extension_list = optarg;
+            break;
+        case OPTION_MANIFEST:
+            manifest_path = optarg;
+            break;
+        case OPTION_SHARD:
+        {
+            // Shards are numbered from 1 to the number of shards
+            const std::string shard = optarg;
+            const auto slash = shard.find('/');
+
+            shard_count = 0;
+
+            try
+            {
+                if (slash != std::string::npos)
+                {
+                    shard_index = std::stoul(shard.substr(0, slash));
+                    shard_count = std::stoul(shard.substr(slash + 1));
+                }
+            }
+            catch (std::exception &e)
+            {
+                shard_count = 0;
             }
-            toneProfileMinor(profiles);
-            break;     
+
+            if (shard_count == 0 || shard_index == 0 || shard_index > shard_count)
+            {
+                std::cerr << "Invalid shard, expected index/count such as 1/4" << std::endl;
+                return 1;
+            }
+
+            --shard_index;
+            break;
+        }
+        case OPTION_MERGE_CACHE:
+            merge_paths.push_back(optarg);
+            break;
+        case OPTION_MAX_SECONDS:
+        case OPTION_MAX_DURATION:
+        {
+            double seconds = -1;
+
+            try
+            {
+                seconds = std::stod(optarg);
+            }
+            catch (std::exception &e) {}
+
+            if ( ! (seconds > 0))
+            {
+                std::cerr << "Invalid limit, expected a positive number of seconds" << std::endl;
+                return 1;
+            }
+
+            (c == OPTION_MAX_SECONDS ? decode_options.max_seconds : decode_options.max_duration) = seconds;
+            break;
+        }
+        case OPTION_MAX_SAMPLES:
+        {
+            unsigned long long count;
+
+            if ( ! parse_count(optarg, UINT64_MAX, count) || count == 0)
+            {
+                std::cerr << "Invalid number of samples" << std::endl;
+                return 1;
+            }
+
+            decode_options.max_samples = count;
+            break;
+        }
+        case OPTION_TOP:
+        {
+            // More keys than there are are simply all of them
+            unsigned long long count;
+
+            if ( ! parse_count(optarg, SIZE_MAX, count) || count == 0)
+            {
+                std::cerr << "Invalid number of keys" << std::endl;
+                return 1;
+            }
+
+            output_options.top_count = count;
+            break;
+        }
+        }
+    }
+
+    // Directories are only walked once all the options are known, as the
+    // extensions may be given after them
+    const auto extensions = parse_extensions(extension_list);
+
+    if (extensions.empty())
+    {
+        std::cerr << "Invalid extensions, expected a comma separated list" << std::endl;
+        return 1;
+    }
+
+    for (const auto &directory : recursive_paths)
+    {
+        if ( ! find_audio_files(directory, extensions, file_paths))
+        {
+            std::cerr << "Unable to read directory " << directory << std::endl;
+            return 1;
         }
     }
 
-    // There should be at least one argument left for the filename. We can
-    // check for this by seeing if the opt parser's last index is larger than
-    // the arg count.
-    if (optind >= argc)
+    // Any arguments left after the options are files to analyze
+    file_paths.insert(file_paths.end(), argv + optind, argv + argc);
+
+    const bool server_mode = serve || ! listen_path.empty();
+
+    // A library with no audio files is an empty batch, not a usage error
+    if (file_paths.empty() && recursive_paths.empty() && rescore_path.empty() && ! server_mode
+            && merge_paths.empty())
     {
         display_usage(std::cerr);
         return 1;
     }
 
-    char* file_path = argv[optind];
+    if ( ! merge_paths.empty() && cache_path.empty())
+    {
+        std::cerr << "Merging caches needs a cache to merge them into, given with --cache" << std::endl;
+        return 1;
+    }
+
+    // Every shard is written with paths so the outputs of all of them can be
+    // combined, even when a shard ends up with a single file
+    if (shard_count > 0)
+    {
+        if (server_mode)
+        {
+            std::cerr << "A shard can't be used with --serve or --listen" << std::endl;
+            return 1;
+        }
+
+        file_paths.erase(std::remove_if(file_paths.begin(), file_paths.end(),
+                    [=](const std::string &path) { return ! in_shard(path, shard_index, shard_count); }),
+                file_paths.end());
+
+        batch_mode = true;
+    }
+
+    // The manifest describes the files of a batch, a server has no batch
+    if ( ! manifest_path.empty() && server_mode)
+    {
+        std::cerr << "A manifest can't be used with --serve or --listen" << std::endl;
+        return 1;
+    }
+
+    // Audio can only be read from standard input once, and only when nothing
+    // else is read from it
+    const auto stdin_files = std::count(file_paths.begin(), file_paths.end(), "-");
+
+    if (stdin_files > 1 || (stdin_files > 0 && (list_from_stdin || serve)))
+    {
+        std::cerr << "Standard input can only be read once" << std::endl;
+        return 1;
+    }
+
+    // Multiple files are output along with their path so the results can be
+    // matched up with the inputs
+    batch_mode = batch_mode || file_paths.size() > 1 || ! rescore_path.empty() || server_mode;
+
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    // A server keeps all of its workers running for requests yet to come
+    if ( ! server_mode)
+        jobs = std::min<std::size_t>(jobs, file_paths.size());
+
+    if (queue_depth == 0)
+        queue_depth = 2 * jobs;
+
+    // Without any named profile sets the key is estimated using the default
+    // (or --major and --minor) profiles
+    if (profile_sets.empty())
+        profile_sets.push_back(toneProfileSet("default", major_profile, minor_profile));
+
+    // Only used to score stored chromagrams and fingerprint parameters, each
+    // worker analyzes files with its own analyzer
+    const KeyAnalyzer main_analyzer(decode_options, profile_sets);
+
+    output_options.with_paths = batch_mode;
+    output_options.top_count = std::min<std::size_t>(output_options.top_count, KeyScoring::KEYS);
+
+    std::vector<std::string> profile_names;
+    for (const auto &set : profile_sets)
+        profile_names.push_back(set.name);
+
+    // Results are written in large blocks rather than line by line
+    std::ios::sync_with_stdio(false);
+
+    // Re-estimate the keys of previously stored chromagrams, no audio needs
+    // to be decoded at all
+    if ( ! rescore_path.empty())
+    {
+        ResultWriter result_writer(std::cout, std::cerr, output_options, profile_names);
+
+        try
+        {
+            ChromaStore::Reader reader(rescore_path);
+
+            AnalysisResult result = {0, ""};
+            std::vector<double> chromagram;
+
+            while (reader.next(result.file_path, chromagram))
+            {
+                main_analyzer.score(chromagram, result.keys, result.scores);
+                result_writer.write(result);
+            }
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        std::cout.flush();
+        return result_writer.had_errors() ? 1 : 0;
+    }
 
-    KeyFinder::KeyFinder key_finder;
-    KeyFinder::AudioData audio_data;
-    KeyFinder::key_t key;
-    KeyFinder::Workspace workspace;
-    
+    const bool needs_scores = output_options.show_confidence || output_options.top_count > 1;
+
+    std::unique_ptr<ResultCache> result_cache;
+    std::unique_ptr<ChromaStore::Writer> chroma_writer;
+    std::unique_ptr<Manifest> manifest;
+    std::vector<std::string> fingerprints;
+    std::string manifest_fingerprint;
+
+    if ( ! cache_path.empty())
+    {
+        try
+        {
+            result_cache.reset(new ResultCache(cache_path));
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        for (std::size_t i = 0; i < profile_sets.size(); ++i)
+            fingerprints.push_back(ResultCache::fingerprint(main_analyzer.parameters(i)));
+
+        for (const auto &merge_path : merge_paths)
+        {
+            try
+            {
+                result_cache->merge(merge_path);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+        }
+
+        // Only merging caches, there is nothing to analyze
+        if (file_paths.empty() && recursive_paths.empty() && ! server_mode)
+            return 0;
+    }
+
+    // The keys of every profile set are recorded together, so the manifest
+    // fingerprint covers all of them
+    if ( ! manifest_path.empty())
+    {
+        manifest.reset(new Manifest(manifest_path));
+
+        std::string parameters;
+        for (std::size_t i = 0; i < profile_sets.size(); ++i)
+            parameters += main_analyzer.parameters(i) + '\n';
+
+        manifest_fingerprint = ResultCache::fingerprint(parameters);
+    }
+
+    if ( ! chroma_path.empty())
+    {
+        try
+        {
+            chroma_writer.reset(new ChromaStore::Writer(chroma_path));
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
 
     // Hide av* warnings and errors
     av_log_set_callback([](void *, int, const char*, va_list) {});
 
-    try
+    // Analyze a single file into its result. Files which have been analyzed
+    // before with the same parameters don't need to be opened at all, unless
+    // their chromagram is being saved or scores are needed, which aren't
+    // cached. Every file with keys is recorded in the manifest of this run.
+    auto analyze_file = [&](KeyAnalyzer &analyzer, AnalysisResult &result)
     {
-        fill_audio_data(file_path, audio_data);
-        key_finder.progressiveChromagram(audio_data, workspace);
-        key_finder.finalChromagram(workspace);
-        key = key_finder.keyOfChromaVector(workspace.chromagram->collapseToOneHop(),toneProfileMajor(MAJOR_PROFILE),toneProfileMinor(MINOR_PROFILE));
-        //key = key_finder.keyOfAudio(audio_data);
+        ResultCache::FileStamp stamp;
+        const bool stamped = (result_cache || manifest) && result.file_path != "-"
+            && ResultCache::stamp(result.file_path, stamp);
+
+        const bool cacheable = result_cache && stamped;
+        const bool reusable = ! chroma_writer && ! needs_scores;
+        const bool recordable = manifest && stamped;
+
+        if (recordable && reusable
+                && manifest->lookup(result.file_path, manifest_fingerprint, stamp, result.keys))
+        {
+            manifest->record(result.file_path, manifest_fingerprint, stamp, result.keys);
+            result.cached = true;
+            return;
+        }
+
+        bool cached = cacheable && reusable;
+
+        for (std::size_t i = 0; cached && i < profile_sets.size(); ++i)
+        {
+            KeyFinder::key_t key;
+            cached = result_cache->lookup(result.file_path, fingerprints[i], stamp, key);
+            result.keys.push_back(key);
+        }
+
+        if (cached)
+        {
+            if (recordable)
+                manifest->record(result.file_path, manifest_fingerprint, stamp, result.keys);
+
+            result.cached = true;
+            return;
+        }
+
+        result.keys.clear();
+
+        const auto started = std::chrono::steady_clock::now();
+
+        try
+        {
+            const auto chromagram = analyzer.chromagram(result.file_path,
+                    show_stats ? &result.stats : nullptr);
+
+            if (chroma_writer)
+                chroma_writer->write(result.file_path, chromagram);
+
+            analyzer.score(chromagram, result.keys, result.scores);
+        }
+        catch (std::exception &e)
+        {
+            result.error = e.what();
+        }
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        result.stats.seconds = result.seconds;
+        result.stats.peak_rss_kb = show_stats ? AnalysisStats::peak_rss_kb() : 0;
+
+        for (std::size_t i = 0; cacheable && i < result.keys.size(); ++i)
+            result_cache->store(result.file_path, fingerprints[i], stamp, result.keys[i]);
+
+        if (recordable && result.error.empty())
+            manifest->record(result.file_path, manifest_fingerprint, stamp, result.keys);
+    };
+
+    // Answer requests until the input ends, or forever when listening
+    if (server_mode)
+    {
+        try
+        {
+            // Standard input belongs to the server, never to a request
+            auto analyze_request = [&](KeyAnalyzer &analyzer, AnalysisResult &result)
+            {
+                if (result.file_path == "-")
+                    result.error = "Unable to read standard input from a server";
+                else
+                    analyze_file(analyzer, result);
+            };
+
+            KeyServer server(jobs, queue_depth, decode_options, profile_sets, output_options, analyze_request);
+
+            if (serve)
+                server.serve(std::cin, STDOUT_FILENO, std::cerr);
+            else
+                server.listen(listen_path);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        return 0;
     }
-    catch (std::exception &e)
+
+    ResultWriter result_writer(std::cout, std::cerr, output_options, profile_names);
+
+    BlockingQueue<AnalysisResult> result_queue;
+
+    const auto batch_started = std::chrono::steady_clock::now();
+
+    // Workers take the next file in the schedule whenever they finish one, so
+    // the work is spread evenly however long each file takes
+    const auto schedule_order = schedule_files(file_paths, schedule, jobs);
+    std::atomic<std::size_t> next_position(0);
+
+    // Each worker owns an analyzer, and the KeyFinder instance within it,
+    // which is reused for every file the worker picks up. Pinned workers are
+    // pinned before the analyzer is set up, so it is allocated on their node.
+    auto worker = [&](unsigned int worker_index)
     {
-        std::cerr << e.what() << std::endl;
-        return 1;
+        if (pin && ! pin_worker(worker_index, jobs))
+            std::cerr << "Unable to pin worker " << worker_index << std::endl;
+
+        KeyAnalyzer analyzer(decode_options, profile_sets);
+
+        std::size_t position;
+        while ((position = next_position++) < file_paths.size())
+        {
+            const std::size_t index = schedule_order[position];
+            AnalysisResult result = {index, file_paths[index]};
+
+            // The other workers pick up the files up to this one's next file,
+            // so reading it can start while they and this one are busy
+            if (prefetch && position + jobs < file_paths.size())
+                prefetch_file(file_paths[schedule_order[position + jobs]].c_str());
+
+            analyze_file(analyzer, result);
+            result_queue.push(std::move(result));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < jobs; ++i)
+        workers.emplace_back(worker, i);
+
+    // Stats of each analyzed file are written to stderr alongside its result
+    AnalysisStats::Summary stats_summary;
+
+    auto write_result = [&](const AnalysisResult &result)
+    {
+        result_writer.write(result);
+
+        if ( ! show_stats || result.cached)
+            return;
+
+        AnalysisStats::write_file(std::cerr, result.file_path, result.stats);
+        stats_summary.add(result.stats);
+    };
+
+    // Results are written from this thread only. Unless ordering was disabled
+    // results that complete early are held back until all of the results
+    // before them have been written.
+    std::map<std::size_t, AnalysisResult> pending;
+    std::size_t next_written = 0;
+
+    for (std::size_t i = 0; i < file_paths.size(); ++i)
+    {
+        AnalysisResult result;
+        result_queue.pop(result);
+
+        if (unordered)
+        {
+            write_result(result);
+            continue;
+        }
+
+        pending.emplace(result.index, std::move(result));
+
+        for (auto it = pending.begin(); it != pending.end() && it->first == next_written; ++next_written)
+        {
+            write_result(it->second);
+            it = pending.erase(it);
+        }
     }
 
-    // Only return a key when we don't have silence - rule 12: Be quiet!
-    if (key != KeyFinder::SILENCE)
+    for (auto &thread : workers)
+        thread.join();
+
+    if (show_stats)
+    {
+        stats_summary.write(std::cerr,
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_started).count());
+    }
+
+    std::cout.flush();
+
+    if (manifest)
     {
-        std::cout << selected_notation[key] << std::endl;
+        try
+        {
+            // A shard only analyzes its own files, the entries of the other
+            // shards are left as they were
+            if (shard_count > 0)
+            {
+                manifest->save([=](const std::string &path)
+                {
+                    return ! in_shard(path, shard_index, shard_count);
+                });
+            }
+            else
+                manifest->save();
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
     }
 
-    return 0;
+    return result_writer.had_errors() ? 1 : 0;
 }
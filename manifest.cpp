@@ -0,0 +1,102 @@
+#include "manifest.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+Manifest::Manifest(const std::string &manifest_path)
+    : manifest_path(manifest_path)
+{
+    // A first run has no manifest yet
+    std::ifstream manifest_file(manifest_path);
+    std::string line;
+    ResultCache::Record record;
+
+    while (std::getline(manifest_file, line))
+    {
+        if (ResultCache::parse_record(line, record))
+            previous[record.file_path] = {record.fingerprint, record.stamp, record.keys};
+    }
+}
+
+bool Manifest::lookup(const std::string &file_path, const std::string &fingerprint,
+        const ResultCache::FileStamp &stamp, std::vector<KeyFinder::key_t> &keys)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto entry = previous.find(file_path);
+
+    if (entry == previous.end() || entry->second.fingerprint != fingerprint)
+        return false;
+
+    if (entry->second.stamp.size != stamp.size || entry->second.stamp.mtime != stamp.mtime)
+        return false;
+
+    keys = entry->second.keys;
+    return true;
+}
+
+void Manifest::record(const std::string &file_path, const std::string &fingerprint,
+        const ResultCache::FileStamp &stamp, const std::vector<KeyFinder::key_t> &keys)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    current[file_path] = {fingerprint, stamp, keys};
+}
+
+void Manifest::save(const std::function<bool(const std::string &file_path)> &carry_over)
+{
+    std::string data;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::map<std::string, Entry> sorted(current.begin(), current.end());
+
+        for (const auto &entry : previous)
+        {
+            if (carry_over && carry_over(entry.first))
+                sorted.insert(entry);
+        }
+
+        // Files which can't be recorded are left out, and analyzed again
+        for (const auto &entry : sorted)
+        {
+            ResultCache::format_record({entry.second.fingerprint, entry.second.stamp,
+                    entry.second.keys, entry.first}, data);
+        }
+    }
+
+    // Written next to the manifest, so that the rename never crosses file
+    // systems, and synced before the rename so that a crash leaves either
+    // the old or the new manifest behind
+    const std::string temporary_path = manifest_path + ".tmp." + std::to_string(getpid());
+    const int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        throw std::runtime_error("Unable to write the manifest " + temporary_path);
+
+    bool written = true;
+
+    for (std::size_t offset = 0; written && offset < data.size(); )
+    {
+        const ssize_t count = ::write(fd, data.data() + offset, data.size() - offset);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+
+        written = count > 0;
+        offset += written ? count : 0;
+    }
+
+    written = fsync(fd) == 0 && written;
+
+    if (close(fd) < 0 || ! written || std::rename(temporary_path.c_str(), manifest_path.c_str()) < 0)
+    {
+        unlink(temporary_path.c_str());
+        throw std::runtime_error("Unable to write the manifest " + manifest_path);
+    }
+}
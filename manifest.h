@@ -0,0 +1,84 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <keyfinder/constants.h>
+
+#include "result_cache.h"
+
+/**
+ * A record of the files analyzed by the last run over a library: the path,
+ * size and modification time of each file, and the keys estimated for it
+ * with every profile set. A rerun only needs to analyze the files which are
+ * new or have changed since, reusing the recorded keys of all the others.
+ *
+ * Unlike the result cache, the manifest only ever describes one run. Files
+ * which are not part of a run, or could not be analyzed, are left out of the
+ * manifest it saves, so files removed from the library drop out of it and
+ * failed files are tried again next time. A run over only some of the files,
+ * such as one shard of them, may carry the entries of the others over. The
+ * manifest is replaced as a whole with a rename, so it is never left half
+ * written.
+ *
+ * Each line holds the fingerprint of the analysis parameters, the size and
+ * modification time of the file, the comma separated keys and the path, all
+ * separated by tabs and sorted by path.
+ */
+class Manifest
+{
+public:
+    /**
+     * Read the manifest left by an earlier run, if there is one.
+     *
+     * @param manifest_path The path of the manifest file
+     */
+    explicit Manifest(const std::string &manifest_path);
+
+    Manifest(const Manifest&) = delete;
+    Manifest& operator=(const Manifest&) = delete;
+
+    /**
+     * Look up the keys recorded by the earlier run for a file.
+     *
+     * @return false if the earlier run did not analyze this version of the
+     *         file with the same parameters
+     */
+    bool lookup(const std::string &file_path, const std::string &fingerprint,
+            const ResultCache::FileStamp &stamp, std::vector<KeyFinder::key_t> &keys);
+
+    /**
+     * Record the keys of a file for the manifest of this run. Files with a
+     * newline in their path are left out, and analyzed on every run.
+     */
+    void record(const std::string &file_path, const std::string &fingerprint,
+            const ResultCache::FileStamp &stamp, const std::vector<KeyFinder::key_t> &keys);
+
+    /**
+     * Replace the manifest file with the files recorded by this run.
+     *
+     * @param carry_over When given, the entries of the earlier run for the
+     *                   files it accepts are kept, unless this run recorded
+     *                   the file again
+     */
+    void save(const std::function<bool(const std::string &file_path)> &carry_over = nullptr);
+
+private:
+    struct Entry
+    {
+        std::string fingerprint;
+        ResultCache::FileStamp stamp;
+        std::vector<KeyFinder::key_t> keys;
+    };
+
+    std::string manifest_path;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> previous;
+    std::unordered_map<std::string, Entry> current;
+};
+
+#endif
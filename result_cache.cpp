@@ -0,0 +1,204 @@
+#include "result_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ResultCache::ResultCache(const std::string &cache_path)
+{
+    // A new cache has no file to replay yet
+    read_entries(cache_path, entries);
+
+    cache_fd = open(cache_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (cache_fd < 0)
+        throw std::runtime_error("Unable to open the result cache " + cache_path);
+}
+
+ResultCache::~ResultCache()
+{
+    close(cache_fd);
+}
+
+std::string ResultCache::fingerprint(const std::string &parameters)
+{
+    // 64 bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned char c : parameters)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+
+    return hex;
+}
+
+bool ResultCache::stamp(const std::string &file_path, FileStamp &stamp)
+{
+    struct stat file_stat;
+
+    if (::stat(file_path.c_str(), &file_stat) < 0)
+        return false;
+
+    stamp.size = file_stat.st_size;
+
+#ifdef __APPLE__
+    stamp.mtime = file_stat.st_mtimespec.tv_sec * 1000000000LL + file_stat.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec;
+#endif
+
+    return true;
+}
+
+bool ResultCache::lookup(const std::string &file_path, const std::string &fingerprint,
+        const FileStamp &stamp, KeyFinder::key_t &key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto entry = entries.find(entry_key(file_path, fingerprint));
+
+    if (entry == entries.end())
+        return false;
+
+    if (entry->second.stamp.size != stamp.size || entry->second.stamp.mtime != stamp.mtime)
+        return false;
+
+    key = entry->second.key;
+    return true;
+}
+
+void ResultCache::store(const std::string &file_path, const std::string &fingerprint,
+        const FileStamp &stamp, KeyFinder::key_t key)
+{
+    std::string line;
+
+    if ( ! format_record({fingerprint, stamp, {key}, file_path}, line))
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[entry_key(file_path, fingerprint)] = {stamp, key};
+
+    // A failure to write only means the result will be recomputed next time
+    if (write(cache_fd, line.data(), line.size()) < 0)
+        return;
+}
+
+std::size_t ResultCache::merge(const std::string &other_path)
+{
+    entry_map others;
+
+    if ( ! read_entries(other_path, others))
+        throw std::runtime_error("Unable to open the result cache " + other_path);
+
+    std::size_t added = 0;
+
+    for (const auto &other : others)
+    {
+        bool newer;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            const auto entry = entries.find(other.first);
+            newer = entry == entries.end() || entry->second.stamp.mtime < other.second.stamp.mtime;
+        }
+
+        if ( ! newer)
+            continue;
+
+        const auto separator = other.first.find('\0');
+        store(other.first.substr(separator + 1), other.first.substr(0, separator),
+                other.second.stamp, other.second.key);
+
+        ++added;
+    }
+
+    return added;
+}
+
+bool ResultCache::read_entries(const std::string &cache_path, entry_map &entries)
+{
+    std::ifstream cache_file(cache_path);
+    std::string line;
+
+    if ( ! cache_file)
+        return false;
+
+    Record record;
+
+    while (std::getline(cache_file, line))
+    {
+        if ( ! parse_record(line, record) || record.keys.size() != 1)
+            continue;
+
+        entries[entry_key(record.file_path, record.fingerprint)] = {record.stamp, record.keys[0]};
+    }
+
+    return true;
+}
+
+bool ResultCache::parse_record(const std::string &line, Record &record)
+{
+    std::istringstream fields(line);
+    std::string keys;
+
+    fields >> record.fingerprint >> record.stamp.size >> record.stamp.mtime >> keys;
+
+    // The path is the remainder of the line after the tab
+    if ( ! fields || fields.get() != '\t' || ! std::getline(fields, record.file_path))
+        return false;
+
+    std::istringstream key_list(keys);
+    std::string key_field;
+
+    record.keys.clear();
+
+    while (std::getline(key_list, key_field, ','))
+    {
+        int key = -1;
+
+        try
+        {
+            key = std::stoi(key_field);
+        }
+        catch (std::exception &e) {}
+
+        if (key < 0 || key > KeyFinder::SILENCE)
+            return false;
+
+        record.keys.push_back((KeyFinder::key_t) key);
+    }
+
+    return ! record.keys.empty();
+}
+
+bool ResultCache::format_record(const Record &record, std::string &buffer)
+{
+    if (record.file_path.find('\n') != std::string::npos)
+        return false;
+
+    std::ostringstream line;
+    line << record.fingerprint << '\t' << record.stamp.size << '\t' << record.stamp.mtime << '\t';
+
+    for (std::size_t i = 0; i < record.keys.size(); ++i)
+        line << (i > 0 ? "," : "") << (int) record.keys[i];
+
+    line << '\t' << record.file_path << '\n';
+
+    buffer += line.str();
+    return true;
+}
+
+std::string ResultCache::entry_key(const std::string &file_path, const std::string &fingerprint)
+{
+    return fingerprint + '\0' + file_path;
+}
@@ -0,0 +1,138 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <keyfinder/constants.h>
+
+/**
+ * An on-disk cache of estimated keys. Results are keyed by the path of the
+ * file, its size and modification time, and a fingerprint of everything else
+ * that affects the result (tone profiles, decode options, libkeyfinder
+ * build). Changing any of these simply misses the cache.
+ *
+ * The cache file is an append-only log with one result per line, which is
+ * read into memory when the cache is opened. Each result is appended with a
+ * single write, so many processes may safely share the same cache file.
+ * Processes which can't share a file, such as the nodes of a cluster each
+ * analyzing a shard of the files, keep caches of their own which are merged
+ * afterwards.
+ */
+class ResultCache
+{
+public:
+    /**
+     * Identifies a version of a file without having to read it.
+     */
+    struct FileStamp
+    {
+        int64_t size;
+        int64_t mtime;
+    };
+
+    /**
+     * A line of a cache file, or of a Manifest: the fingerprint, the size
+     * and modification time of the file, its comma separated keys and its
+     * path, separated by tabs. A cache record holds a single key.
+     */
+    struct Record
+    {
+        std::string fingerprint;
+        FileStamp stamp;
+        std::vector<KeyFinder::key_t> keys;
+        std::string file_path;
+    };
+
+    /**
+     * Parse a record from a line, without its newline.
+     *
+     * @return false if the line isn't a valid record
+     */
+    static bool parse_record(const std::string &line, Record &record);
+
+    /**
+     * Append a record to a buffer as a line. Files with a newline in their
+     * path can't be recorded, as their record would be split into a
+     * truncated path, which may be that of another file, and a garbage line.
+     *
+     * @return false if the record could not be formatted
+     */
+    static bool format_record(const Record &record, std::string &buffer);
+
+    /**
+     * Open the cache file, creating it if it does not yet exist.
+     *
+     * @param cache_path The path of the cache file
+     */
+    explicit ResultCache(const std::string &cache_path);
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    /**
+     * Compute a compact fingerprint from a description of the parameters
+     * that affect a result.
+     */
+    static std::string fingerprint(const std::string &parameters);
+
+    /**
+     * Determine the stamp of a file.
+     *
+     * @return false if the file could not be stat'ed
+     */
+    static bool stamp(const std::string &file_path, FileStamp &stamp);
+
+    /**
+     * Look up the cached key of a file.
+     *
+     * @return false if there is no result for this version of the file
+     */
+    bool lookup(const std::string &file_path, const std::string &fingerprint,
+            const FileStamp &stamp, KeyFinder::key_t &key);
+
+    /**
+     * Record the key of a file, both in memory and in the cache file. Files
+     * with a newline in their path are never cached.
+     */
+    void store(const std::string &file_path, const std::string &fingerprint,
+            const FileStamp &stamp, KeyFinder::key_t key);
+
+    /**
+     * Add the results of another cache file to this cache. Where both caches
+     * hold a result for the same file and parameters, the result for the
+     * newest version of the file is kept.
+     *
+     * @param other_path The path of the cache file to merge
+     * @return The number of results which were added
+     */
+    std::size_t merge(const std::string &other_path);
+
+private:
+    struct Entry
+    {
+        FileStamp stamp;
+        KeyFinder::key_t key;
+    };
+
+    typedef std::unordered_map<std::string, Entry> entry_map;
+
+    /**
+     * Replay a cache file into a map of results, later results replacing
+     * earlier ones.
+     *
+     * @return false if the file could not be opened
+     */
+    static bool read_entries(const std::string &cache_path, entry_map &entries);
+
+    static std::string entry_key(const std::string &file_path, const std::string &fingerprint);
+
+    std::mutex mutex;
+    entry_map entries;
+    int cache_fd;
+};
+
+#endif
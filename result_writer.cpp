@@ -0,0 +1,263 @@
+#include "result_writer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+/**
+ * Quote a string as a JSON string.
+ */
+std::string json_string(const std::string &value)
+{
+    std::ostringstream quoted;
+    quoted << '"';
+
+    for (const unsigned char c : value)
+    {
+        switch (c)
+        {
+        case '"':  quoted << "\\\""; break;
+        case '\\': quoted << "\\\\"; break;
+        case '\n': quoted << "\\n";  break;
+        case '\r': quoted << "\\r";  break;
+        case '\t': quoted << "\\t";  break;
+        default:
+            if (c < 0x20)
+                quoted << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c;
+            else
+                quoted << c;
+        }
+    }
+
+    quoted << '"';
+    return quoted.str();
+}
+
+/**
+ * Replace the characters that would break up a TSV record with spaces.
+ */
+std::string tsv_field(std::string value)
+{
+    std::replace_if(value.begin(), value.end(), [](char c)
+    {
+        return c == '\t' || c == '\n' || c == '\r';
+    }, ' ');
+
+    return value;
+}
+}
+
+ResultWriter::ResultWriter(std::ostream &output, std::ostream &errors,
+        const OutputOptions &options, std::vector<std::string> profile_names)
+    : output(output), errors(errors), options(options), profile_names(std::move(profile_names))
+{
+    output << std::fixed << std::setprecision(4);
+
+    if (options.format != OutputFormat::TSV)
+        return;
+
+    output << "path\tprofile\tstatus";
+
+    for (const auto &mapping : KeyNotation::mappings)
+        output << '\t' << mapping.first;
+
+    output << "\tscore\tmargin\tseconds\tcached\terror\n";
+}
+
+void ResultWriter::write(const AnalysisResult &result)
+{
+    failed = failed || ! result.error.empty();
+
+    switch (options.format)
+    {
+    case OutputFormat::TEXT:  write_text(result);  break;
+    case OutputFormat::JSONL: write_jsonl(result); break;
+    case OutputFormat::TSV:   write_tsv(result);   break;
+    }
+}
+
+bool ResultWriter::had_errors() const
+{
+    return failed;
+}
+
+void ResultWriter::write_text(const AnalysisResult &result)
+{
+    if ( ! result.error.empty())
+    {
+        if (options.with_paths)
+            errors << result.file_path << ": ";
+
+        errors << result.error << std::endl;
+        return;
+    }
+
+    for (std::size_t i = 0; i < result.keys.size(); ++i)
+    {
+        // Only return a key when we don't have silence - rule 12: Be quiet!
+        if (result.keys[i] == KeyFinder::SILENCE)
+            continue;
+
+        if (options.with_paths)
+            output << result.file_path << '\t';
+
+        if (profile_names.size() > 1)
+            output << profile_names[i] << '\t';
+
+        if (i < result.scores.size())
+            write_text_keys(result.scores[i]);
+        else
+            output << options.notation[result.keys[i]];
+
+        output << '\n';
+    }
+}
+
+// The keys are followed by their scores when asked for, then the margin
+// between the best and second best scores
+void ResultWriter::write_text_keys(const KeyScoring::Scores &scores)
+{
+    const auto ranked = KeyScoring::KeyScorer::ranked_keys(scores);
+
+    for (std::size_t i = 0; i < options.top_count; ++i)
+    {
+        if (i > 0)
+            output << '\t';
+
+        output << options.notation[ranked[i]];
+
+        if (options.show_confidence)
+            output << '\t' << scores[ranked[i]];
+    }
+
+    if (options.show_confidence)
+        output << '\t' << scores[ranked[0]] - scores[ranked[1]];
+}
+
+void ResultWriter::write_jsonl(const AnalysisResult &result)
+{
+    output << "{\"path\":" << json_string(result.file_path)
+           << ",\"status\":\"" << status(result) << '"'
+           << ",\"seconds\":" << result.seconds
+           << ",\"cached\":" << (result.cached ? "true" : "false");
+
+    if ( ! result.error.empty())
+        output << ",\"error\":" << json_string(result.error);
+
+    output << ",\"results\":[";
+
+    for (std::size_t i = 0; i < result.keys.size(); ++i)
+    {
+        if (i > 0)
+            output << ',';
+
+        output << "{\"profile\":" << json_string(profile_names[i]) << ",\"key\":";
+        write_json_key(result.keys[i]);
+
+        if (i < result.scores.size())
+        {
+            const auto &scores = result.scores[i];
+            const auto ranked = KeyScoring::KeyScorer::ranked_keys(scores);
+
+            output << ",\"score\":"  << scores[ranked[0]]
+                   << ",\"margin\":" << scores[ranked[0]] - scores[ranked[1]];
+
+            if (options.top_count > 1)
+            {
+                output << ",\"top\":[";
+
+                for (std::size_t k = 0; k < options.top_count; ++k)
+                {
+                    output << (k > 0 ? "," : "") << "{\"key\":";
+                    write_json_key(ranked[k]);
+                    output << ",\"score\":" << scores[ranked[k]] << '}';
+                }
+
+                output << ']';
+            }
+        }
+
+        output << '}';
+    }
+
+    output << "]}\n";
+}
+
+void ResultWriter::write_json_key(KeyFinder::key_t key)
+{
+    if (key == KeyFinder::SILENCE)
+    {
+        output << "null";
+        return;
+    }
+
+    output << '{';
+
+    for (auto mapping = KeyNotation::mappings.begin(); mapping != KeyNotation::mappings.end(); ++mapping)
+    {
+        output << (mapping == KeyNotation::mappings.begin() ? "" : ",")
+               << json_string(mapping->first) << ':' << json_string(mapping->second[key]);
+    }
+
+    output << '}';
+}
+
+void ResultWriter::write_tsv(const AnalysisResult &result)
+{
+    const auto path = tsv_field(result.file_path);
+
+    if ( ! result.error.empty())
+    {
+        output << path << "\t\t" << status(result);
+
+        for (std::size_t i = 0; i < KeyNotation::mappings.size(); ++i)
+            output << '\t';
+
+        output << "\t\t\t" << result.seconds << '\t' << result.cached
+               << '\t' << tsv_field(result.error) << '\n';
+        return;
+    }
+
+    for (std::size_t i = 0; i < result.keys.size(); ++i)
+    {
+        const auto key = result.keys[i];
+
+        output << path << '\t' << tsv_field(profile_names[i]) << '\t'
+               << (key == KeyFinder::SILENCE ? "silence" : "ok");
+
+        for (auto &mapping : KeyNotation::mappings)
+            output << '\t' << (key == KeyFinder::SILENCE ? "" : mapping.second[key]);
+
+        output << '\t';
+
+        if (i < result.scores.size())
+        {
+            const auto &scores = result.scores[i];
+            const auto ranked = KeyScoring::KeyScorer::ranked_keys(scores);
+
+            output << scores[ranked[0]] << '\t' << scores[ranked[0]] - scores[ranked[1]];
+        }
+        else
+        {
+            output << '\t';
+        }
+
+        output << '\t' << result.seconds << '\t' << result.cached << "\t\n";
+    }
+}
+
+const char* ResultWriter::status(const AnalysisResult &result)
+{
+    if ( ! result.error.empty())
+        return "error";
+
+    for (const auto key : result.keys)
+    {
+        if (key != KeyFinder::SILENCE)
+            return "ok";
+    }
+
+    return "silence";
+}
@@ -0,0 +1,117 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <keyfinder/constants.h>
+
+#include "analysis_stats.h"
+#include "key_notations.h"
+#include "key_scoring.h"
+
+/**
+ * The outcome of analyzing a single file from the list of inputs.
+ */
+struct AnalysisResult
+{
+    std::size_t index;
+    std::string file_path;
+
+    // The estimated key for each of the tone profile sets, along with the
+    // score of every key when the file was analyzed (rather than cached)
+    std::vector<KeyFinder::key_t> keys;
+    std::vector<KeyScoring::Scores> scores;
+
+    std::string error;
+
+    // The wall time in seconds taken to analyze the file
+    double seconds;
+
+    // Set when the keys were taken from the result cache
+    bool cached;
+
+    // Measurements of the analysis, when collecting stats
+    AnalysisStats::FileStats stats;
+};
+
+/**
+ * The formats results can be written in.
+ */
+enum class OutputFormat
+{
+    TEXT,
+    JSONL,
+    TSV,
+};
+
+/**
+ * Options controlling how results are written by a ResultWriter.
+ */
+struct OutputOptions
+{
+    OutputFormat format = OutputFormat::TEXT;
+
+    // The notation keys are written in as text, the other formats use all
+    KeyNotation::key_map notation = KeyNotation::standard;
+
+    // Prefix text results with the path of the file they're for
+    bool with_paths = false;
+
+    // The number of best matching keys to write
+    std::size_t top_count = 1;
+
+    // Write the score of each key and the confidence margin
+    bool show_confidence = false;
+};
+
+/**
+ * Writes analysis results in one of the output formats.
+ *
+ *  - TEXT writes one line for each key that isn't silence, as the keys
+ *    would be displayed to a user. Errors are written to the error stream.
+ *
+ *  - JSONL writes a JSON object for each file, holding its status, timing
+ *    and the key estimated by each profile in every notation.
+ *
+ *  - TSV writes a header followed by a record for each profile of each file,
+ *    with the same fields as JSONL.
+ *
+ * JSONL and TSV write a record for every file, including silent files and
+ * files which failed to be analyzed. Lines are never flushed individually,
+ * the output stream should be flushed once the results have been written.
+ */
+class ResultWriter
+{
+public:
+    ResultWriter(std::ostream &output, std::ostream &errors,
+            const OutputOptions &options, std::vector<std::string> profile_names);
+
+    void write(const AnalysisResult &result);
+
+    /**
+     * @return true if any of the written results were errors
+     */
+    bool had_errors() const;
+
+private:
+    void write_text(const AnalysisResult &result);
+    void write_text_keys(const KeyScoring::Scores &scores);
+    void write_jsonl(const AnalysisResult &result);
+    void write_json_key(KeyFinder::key_t key);
+    void write_tsv(const AnalysisResult &result);
+
+    /**
+     * The status of a file as a whole: error, silence when every profile
+     * found silence, otherwise ok.
+     */
+    static const char* status(const AnalysisResult &result);
+
+    std::ostream &output;
+    std::ostream &errors;
+    OutputOptions options;
+    std::vector<std::string> profile_names;
+    bool failed = false;
+};
+
+#endif
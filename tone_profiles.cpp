@@ -0,0 +1,131 @@
+#include "tone_profiles.h"
+
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+  double MAJOR_PROFILE[SEMITONES] = {
+    7.23900502618145225142,
+    3.50351166725158691406,
+    3.58445177536649417505,
+    2.84511816478676315967,
+    5.81898892118549859731,
+    4.55865057415321039969,
+    2.44778850545506543313,
+    6.99473192146829525484,
+    3.39106613673504853068,
+    4.55614256655143456953,
+    4.07392666663523606019,
+    4.45932757378886890365,
+
+  };
+
+  double MINOR_PROFILE[SEMITONES] = {
+    7.00255045060284420089,
+    3.14360279015996679775,
+    4.35904319714962529275,
+    5.40418120718934069657,
+    3.67234420879306133756,
+    4.08971184917797891956,
+    3.90791435991553992579,
+    6.19960288562316463867,
+    3.63424625625277419871,
+    2.87241191079875557435,
+    5.35467999794542670600,
+    3.83242038595048351013,
+  };
+  // This is magic, magic, MAAAAAAAAGIC! 
+  double OCTAVE_WEIGHTS[OCTAVES] = {
+    0.39997267549999998559,
+    0.55634425248300645173,
+    0.52496636345143543600,
+    0.60847548384277727607,
+    0.59898115679999996974,
+    0.49072435317960994006,
+  };
+
+  std::vector<double> toneProfile(const double profile[SEMITONES]) {
+    std::vector<double> tp;
+    tp.reserve(OCTAVES * SEMITONES);
+
+    for (unsigned int o = 0; o < OCTAVES; o++) {
+      for (unsigned int s = 0; s < SEMITONES; s++) {
+        tp.push_back(OCTAVE_WEIGHTS[o] * profile[s]);
+      }
+    }
+    return tp;
+  }
+
+  ToneProfileSet toneProfileSet(const std::string &name,
+      const double major[SEMITONES], const double minor[SEMITONES]) {
+    const auto tpMajor = toneProfile(major);
+    const auto tpMinor = toneProfile(minor);
+
+    return {name, tpMajor, tpMinor, KeyScoring::KeyScorer(tpMajor, tpMinor)};
+  }
+
+namespace
+{
+template<typename Out>
+void split(const std::string &s, char delim, Out result) {
+    std::stringstream ss;
+    ss.str(s);
+    std::string item;
+    while (std::getline(ss, item, delim)) {
+        *(result++) = item;
+    }
+}
+
+
+std::vector<std::string> split(const std::string &s, char delim) {
+    std::vector<std::string> elems;
+    split(s, delim, std::back_inserter(elems));
+    return elems;
+}
+}
+
+bool parse_profile(const std::string &values, double profile[SEMITONES])
+{
+    const auto profile_str = split(values, ',');
+
+    if (profile_str.size() != SEMITONES)
+        return false;
+
+    try
+    {
+        for (unsigned int s = 0; s < SEMITONES; s++)
+            profile[s] = std::stod(profile_str[s]);
+    }
+    catch (std::exception &e)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void read_profile_sets(std::istream &stream, std::vector<ToneProfileSet> &sets)
+{
+    std::string line;
+    unsigned int line_number = 0;
+
+    while (std::getline(stream, line))
+    {
+        ++line_number;
+
+        std::istringstream fields(line);
+        std::string name, major, minor, extra;
+
+        if ( ! (fields >> name) || name[0] == '#')
+            continue;
+
+        double major_profile[SEMITONES], minor_profile[SEMITONES];
+
+        if ( ! (fields >> major >> minor) || fields >> extra
+                || ! parse_profile(major, major_profile)
+                || ! parse_profile(minor, minor_profile))
+            throw std::runtime_error("Invalid tone profile set on line " + std::to_string(line_number));
+
+        sets.push_back(toneProfileSet(name, major_profile, minor_profile));
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef TONE_PROFILES_H
+#define TONE_PROFILES_H
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "key_notations.h"
+#include "key_scoring.h"
+
+// The default major and minor tone profiles of libkeyfinder, one value for
+// each semitone, and the weight each octave of the chromagram is given
+extern double MAJOR_PROFILE[SEMITONES];
+extern double MINOR_PROFILE[SEMITONES];
+extern double OCTAVE_WEIGHTS[OCTAVES];
+
+/**
+ * A named pair of major and minor tone profiles, each weighted across all of
+ * the octaves of the chromagram, along with the scorer built from them.
+ */
+struct ToneProfileSet
+{
+    std::string name;
+    std::vector<double> major;
+    std::vector<double> minor;
+    KeyScoring::KeyScorer scorer;
+};
+
+/**
+ * Weight a tone profile across all of the octaves of the chromagram.
+ */
+std::vector<double> toneProfile(const double profile[SEMITONES]);
+
+/**
+ * Build a named tone profile set from a major and a minor profile, each with
+ * one value for every semitone.
+ */
+ToneProfileSet toneProfileSet(const std::string &name,
+        const double major[SEMITONES], const double minor[SEMITONES]);
+
+/**
+ * Parse a comma separated list of the values of a tone profile, one for each
+ * semitone.
+ *
+ * @param values  The comma separated values
+ * @param profile The profile to fill
+ * @return false if the list isn't made up of exactly SEMITONES numbers
+ */
+bool parse_profile(const std::string &values, double profile[SEMITONES]);
+
+/**
+ * Read named sets of tone profiles, one set per line. Each line holds the
+ * name of the set followed by the major and minor profiles, separated by
+ * whitespace, with the profiles written as for --major and --minor. Empty
+ * lines and lines starting with a # are ignored.
+ *
+ * @param stream The stream to read the profile sets from
+ * @param sets   The list to append the profile sets to
+ */
+void read_profile_sets(std::istream &stream, std::vector<ToneProfileSet> &sets);
+
+#endif